@@ -0,0 +1,94 @@
+/*
+ * barcat prints barbar's current line once and exits, for consumers
+ * that poll instead of reading a stream, e.g. in tmux.conf:
+
+ *   set -g status-right '#(barcat music bartime)'
+
+ * the line is laid out as barbar lays out its own, module budgets,
+ * short forms and all; with module names only those are, in the given
+ * order.
+ * it maps the segment read-only and takes a seqlock snapshot of the
+ * slots, so it never takes (or waits on) the writers' lock
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+int
+main(int argc, char *argv[])
+{
+	const struct shared_data *shm_data;
+	static struct cell cells[NUM_MODULES];
+	struct slot slots[NUM_MODULES];
+	struct timespec now;
+	struct stat sb;
+	char out[MAX_LEN];
+	size_t len;
+	int order[NUM_MODULES], n = 0, fd, i, j;
+
+	/* which modules, in which order */
+	if (argc == 1)
+		for (i = 0; i < (int)NUM_MODULES; ++i)
+			order[n++] = i;
+	for (i = 1; i < argc && n < (int)NUM_MODULES; ++i) {
+		for (j = 0; j < (int)NUM_MODULES; ++j)
+			if (!strcmp(argv[i], MODULES[j]))
+				break;
+		if (j == (int)NUM_MODULES) {
+			fprintf(stderr, "%s: unknown module %s\n", argv[0], argv[i]);
+			return 1;
+		}
+		order[n++] = j;
+	}
+
+	/* clock slots in the language barbar shows them in, and
+	 * widths measured as barbar measures them */
+	setlocale(LC_TIME, TIME_LOCALE);
+	if (!setlocale(LC_CTYPE, "") || MB_CUR_MAX == 1)
+		setlocale(LC_CTYPE, "C.UTF-8");
+
+	/* no barbar: print nothing, as an empty bar would */
+	fd = shm_open(SHM_NAME, O_RDONLY, 0);
+	if (fd == -1)
+		return 1;
+	if (fstat(fd, &sb) == -1 ||
+	    sb.st_size < (off_t)sizeof(struct shared_data)) {
+		close(fd);
+		return 1;
+	}
+	shm_data = mmap(NULL, sizeof(struct shared_data), PROT_READ,
+	                MAP_SHARED, fd, 0);
+	close(fd);
+	/* a retired segment is left by a barbar that exited */
+	if (shm_data == MAP_FAILED || shm_data->magic != SHM_MAGIC ||
+	    shm_data->layout != sizeof(struct shared_data) ||
+	    __atomic_load_n(&shm_data->generation, __ATOMIC_ACQUIRE) == 0)
+		return 1;
+
+	if (!slots_snapshot(shm_data, slots))
+		return 1;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	for (i = 0; i < n; ++i) {
+		cells[i].mod = order[i];
+		render_cell(&cells[i], &slots[order[i]], &shm_data->hist[order[i]],
+		            now.tv_sec);
+	}
+	len = layout(cells, n, out, sizeof(out) - 1);
+	out[len++] = '\n';
+
+	/* a single write, like barbar */
+	write(1, out, len);
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * barclick posts button events into the mailboxes of barbar's slots,
+ * where the modules pick them up in their wait loops
+
+ *   barclick music 1      one left click on the music module, e.g. from
+ *                         a key binding or an xdotool click handler
+ *   barclick              reads "module button" lines from stdin until
+ *                         eof, e.g. lemonbar's output with the modules
+ *                         wrapped in %{A1:music 1:}...%{A} areas:
+
+ *   ... | lemonbar | barclick
+
+ * the second form stays attached, so a click costs a futex wake and
+ * no process spawn. barbar writes plain text, not the i3bar protocol,
+ * so i3bar has no blocks to send clicks for
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+
+static struct shared_data *shm_data = NULL;
+static uint32_t            shm_gen  = 0;
+
+static int  attach(void);
+static int  find_module(const char *name, size_t len);
+static int  parse_line(const char *line, int *idx, int *button);
+
+int
+main(int argc, char *argv[])
+{
+	char  *line = NULL;
+	size_t cap  = 0;
+	int    idx, button;
+
+	if (argc == 3) {
+		idx    = find_module(argv[1], strlen(argv[1]));
+		button = atoi(argv[2]);
+		if (idx < 0 || button <= 0) {
+			fprintf(stderr, "usage: %s [module button]\n", argv[0]);
+			return 1;
+		}
+		if (!attach()) {
+			fprintf(stderr, "%s: barbar is not running\n", argv[0]);
+			return 1;
+		}
+		mbox_post(shm_data, idx, button);
+		return 0;
+	} else if (argc != 1) {
+		fprintf(stderr, "usage: %s [module button]\n", argv[0]);
+		return 1;
+	}
+
+	while (getline(&line, &cap, stdin) != -1) {
+		if (!parse_line(line, &idx, &button))
+			continue;
+		/* clicks while barbar is down are dropped */
+		if (attach())
+			mbox_post(shm_data, idx, button);
+	}
+	free(line);
+	return 0;
+}
+
+/* maps the live segment, again after barbar restarted; 0 if there is none */
+static int
+attach(void)
+{
+	struct stat sb;
+	uint32_t gen;
+	int fd;
+
+	if (shm_data && __atomic_load_n(&shm_data->generation, __ATOMIC_ACQUIRE)
+	                == shm_gen)
+		return 1;
+	if (shm_data) {
+		munmap(shm_data, sizeof(struct shared_data));
+		shm_data = NULL;
+	}
+
+	fd = shm_open(SHM_NAME, O_RDWR, 0600);
+	if (fd == -1)
+		return 0;
+	if (fstat(fd, &sb) == -1 ||
+	    sb.st_size < (off_t)sizeof(struct shared_data)) {
+		close(fd);
+		return 0;
+	}
+	shm_data = mmap(NULL, sizeof(struct shared_data),
+	                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm_data == MAP_FAILED) {
+		shm_data = NULL;
+		return 0;
+	}
+
+	gen = __atomic_load_n(&shm_data->generation, __ATOMIC_ACQUIRE);
+	if (shm_data->magic != SHM_MAGIC ||
+	    shm_data->layout != sizeof(struct shared_data) || gen == 0) {
+		munmap(shm_data, sizeof(struct shared_data));
+		shm_data = NULL;
+		return 0;
+	}
+	shm_gen = gen;
+	return 1;
+}
+
+static int
+find_module(const char *name, size_t len)
+{
+	for (int i = 0; i < (int)NUM_MODULES; ++i)
+		if (strlen(MODULES[i]) == len && !strncmp(MODULES[i], name, len))
+			return i;
+	return -1;
+}
+
+/* "module button" */
+static int
+parse_line(const char *line, int *idx, int *button)
+{
+	const char *end = line + strcspn(line, " \t");
+
+	*idx = find_module(line, end - line);
+	*button = atoi(end);
+	return *idx >= 0 && *button > 0;
+}
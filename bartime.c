@@ -1,8 +1,6 @@
 #include <signal.h>
 #include <string.h>
-#include <time.h>
 #include <unistd.h>
-#include <locale.h>
 
 #include "util.h"
 
@@ -13,12 +11,11 @@ static volatile sig_atomic_t term_sig = 0;
 
 static void handle_signal(int sig);
 
+/* barbar renders the clock itself (in TIME_LOCALE, see config.h),
+ * so bartime only publishes the format once and waits for a signal */
 int
 main(void)
 {
-	if (!setlocale(LC_TIME, "zh_CN.UTF-8"))
-		w2s(mname, "setlocale failed");
-	
 	struct sigaction sa;
 	sa.sa_handler = handle_signal;
 	sigemptyset(&sa.sa_mask);
@@ -28,19 +25,11 @@ main(void)
 	sigaction(SIGTERM, &sa, NULL); /* ctrl + d */
 	sigaction(SIGHUP, &sa, NULL);  /* window close */
 
-	while (!terminate) {
-		time_t now = time(NULL);
-		struct tm *local_now = localtime(&now);
-		char time_str[64];
-		strftime(time_str, sizeof time_str, 
-			 date_format, local_now);
+	/* re-rendered by barbar at every minute */
+	w2s_clock(mname, 60, date_format);
 
-		w2s(mname, time_str);
-
-		/* sleep until the next minute */
-		long secs_left = 60 - (now % 60);
-		sleep(secs_left);
-	}
+	while (!terminate)
+		pause();
 
 	w2s(mname, "%s", strsignal(term_sig));
 
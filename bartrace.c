@@ -0,0 +1,193 @@
+/*
+ * bartrace merges the trace rings written by barbar and its modules
+ * when run with BARBAR_TRACE=<dir>, and prints them as chrome trace
+ * json, which chrome://tracing and ui.perfetto.dev both load
+
+ *   BARBAR_TRACE=/tmp/bt barbar ...
+ *   cd /tmp/bt && bartrace *.ring > trace.json
+
+ * every w2s() slice starts a flow which ends in the compose slice of
+ * the consumer that picked its version up, so a single update can be
+ * followed from the producer to the write()
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+
+typedef struct {
+	uint64_t    ns;
+	uint32_t    kind;
+	uint32_t    arg;
+	int         pid;
+} Event;
+
+static const char *kind_name[TR_KINDS] = {
+	[TR_W2S_BEGIN]     = "w2s",
+	[TR_W2S_END]       = "w2s",
+	[TR_WAKE]          = "wake",
+	[TR_COMPOSE_BEGIN] = "compose",
+	[TR_COMPOSE_END]   = "compose",
+	[TR_WRITE_BEGIN]   = "write",
+	[TR_WRITE_END]     = "write",
+};
+
+static int  cmp_event(const void *a, const void *b);
+static void emit(const Event *e, const char *ph, const char *extra);
+
+static int first = 1;
+
+int
+main(int argc, char *argv[])
+{
+	Event    *evs = NULL;
+	uint32_t *pending = NULL;
+	size_t    n = 0, npend = 0;
+	char      extra[64];
+	int       i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s ring...\n", argv[0]);
+		return 1;
+	}
+
+	printf("{\"traceEvents\":[");
+
+	for (i = 1; i < argc; ++i) {
+		const struct trace_ring *r;
+		struct stat sb;
+		uint64_t head, cnt, j;
+		Event *tmp;
+		int fd;
+
+		fd = open(argv[i], O_RDONLY);
+		if (fd < 0 || fstat(fd, &sb) < 0 ||
+		    (size_t)sb.st_size < sizeof(struct trace_ring)) {
+			fprintf(stderr, "%s: not a trace ring\n", argv[i]);
+			if (fd >= 0)
+				close(fd);
+			continue;
+		}
+		r = mmap(NULL, sizeof(*r), PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (r == MAP_FAILED || r->magic != TRACE_MAGIC) {
+			fprintf(stderr, "%s: not a trace ring\n", argv[i]);
+			continue;
+		}
+
+		/* name the process track */
+		printf("%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+		       "\"args\":{\"name\":\"%.16s\"}}",
+		       first ? "" : ",", r->pid, r->name);
+		first = 0;
+
+		/* only the last TRACE_LEN events survive in the ring */
+		head = r->head;
+		cnt  = head < TRACE_LEN ? head : TRACE_LEN;
+		tmp  = realloc(evs, (n + cnt) * sizeof(Event));
+		if (!tmp) {
+			perror("realloc");
+			return 1;
+		}
+		evs = tmp;
+		for (j = head - cnt; j < head; ++j) {
+			const struct trace_event *ev = &r->ev[j % TRACE_LEN];
+			if (ev->kind >= TR_KINDS)
+				continue;
+			evs[n].ns   = ev->ns;
+			evs[n].kind = ev->kind;
+			evs[n].arg  = ev->arg;
+			evs[n].pid  = r->pid;
+			++n;
+		}
+		munmap((void *)r, sizeof(*r));
+	}
+
+	qsort(evs, n, sizeof(Event), cmp_event);
+
+	pending = malloc((n ? n : 1) * sizeof(uint32_t));
+	if (!pending) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (size_t k = 0; k < n; ++k) {
+		const Event *e = &evs[k];
+
+		switch (e->kind) {
+		case TR_W2S_BEGIN:
+		case TR_WRITE_BEGIN:
+			emit(e, "B", NULL);
+			break;
+		case TR_W2S_END:
+			/* flow start bound to the enclosing w2s slice */
+			snprintf(extra, sizeof(extra),
+			         ",\"cat\":\"update\",\"id\":%u", e->arg);
+			emit(e, "s", extra);
+			snprintf(extra, sizeof(extra),
+			         ",\"args\":{\"version\":%u}", e->arg);
+			emit(e, "E", extra);
+			pending[npend++] = e->arg;
+			break;
+		case TR_WAKE:
+			snprintf(extra, sizeof(extra),
+			         ",\"s\":\"t\",\"args\":{\"version\":%u}", e->arg);
+			emit(e, "i", extra);
+			break;
+		case TR_COMPOSE_BEGIN:
+			snprintf(extra, sizeof(extra),
+			         ",\"args\":{\"version\":%u}", e->arg);
+			emit(e, "B", extra);
+			/* end every flow this version includes */
+			for (size_t p = 0; p < npend; ) {
+				if ((int32_t)(pending[p] - e->arg) > 0) {
+					++p;
+					continue;
+				}
+				snprintf(extra, sizeof(extra),
+				         ",\"cat\":\"update\",\"id\":%u,"
+				         "\"bp\":\"e\"", pending[p]);
+				emit(e, "f", extra);
+				pending[p] = pending[--npend];
+			}
+			break;
+		case TR_COMPOSE_END:
+		case TR_WRITE_END:
+			snprintf(extra, sizeof(extra),
+			         ",\"args\":{\"bytes\":%d}", (int32_t)e->arg);
+			emit(e, "E", extra);
+			break;
+		}
+	}
+
+	printf("]}\n");
+
+	free(pending);
+	free(evs);
+	return 0;
+}
+
+static int
+cmp_event(const void *a, const void *b)
+{
+	const Event *e1 = a;
+	const Event *e2 = b;
+	return (e1->ns > e2->ns) - (e1->ns < e2->ns);
+}
+
+/* prints one trace event, ts is in microseconds */
+static void
+emit(const Event *e, const char *ph, const char *extra)
+{
+	printf("%s{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":%d,\"tid\":%d,"
+	       "\"ts\":%llu.%03llu%s}",
+	       first ? "" : ",", kind_name[e->kind], ph, e->pid, e->pid,
+	       (unsigned long long)(e->ns / 1000),
+	       (unsigned long long)(e->ns % 1000), extra ? extra : "");
+	first = 0;
+}
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# ccqwatch.sh builds ccqwatch with -DBENCH -DVCLOCK and, for every size,
+# runs it on a list from genlist through one simulated day, printing
+# one line per size, e.g.
+#
+#   ccqwatch lines=100000 parse_ns=9112170 due=5071 future=94829 parses=5 parse_ns_total=40518127 wakeups=279 w2s=280 allocs=15 maxrss_kb=5664
+#
+# parse_ns is the first (cold) parse, parse_ns_total all of them, as the
+# list is parsed again whenever the CCQ_TOPK naps run out. save a run
+# and compare the next one with it to see what a change costs
+#
+#   SIZES="1000 10000" DAY=3600 bench/ccqwatch.sh
+#
+# nothing reaches a running barbar, the virtual clock keeps runs apart
+
+set -e
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+sizes=${SIZES:-1000 10000 100000 1000000 10000000}
+now=${NOW:-1760000000}
+day=${DAY:-86400}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+${CC:-cc} ${CFLAGS:--O2} -DBENCH -DVCLOCK -pthread -o "$tmp/ccqwatch" \
+	"$top/ccqwatch.c" "$top/util.c" -lrt
+mkdir -p "$tmp/home/.local/share/ccq"
+
+for n in $sizes; do
+	"$top/bench/genlist" "$n" "$now" > "$tmp/home/.local/share/ccq/zh"
+	HOME="$tmp/home" BARBAR_VCLOCK_START="$now" \
+	BARBAR_VCLOCK_END=$((now + day)) \
+		"$tmp/ccqwatch" 2>&1 >/dev/null |
+	awk -v n="$n" '
+	function val(key,    i) {
+		for (i = 3; i <= NF; ++i)
+			if (index($i, key "=") == 1)
+				return substr($i, length(key) + 2)
+		return ""
+	}
+	$1 == "ccqwatch" && $2 == "parse" {
+		if (!parses++) {
+			first = val("ns")
+			due = val("due")
+			future = val("future")
+		}
+		total += val("ns")
+	}
+	$1 == "ccqwatch" && $2 == "exit" {
+		printf "ccqwatch lines=%s parse_ns=%s due=%s future=%s " \
+		       "parses=%d parse_ns_total=%.0f wakeups=%s w2s=%s " \
+		       "allocs=%s maxrss_kb=%s\n", n, first, due, future,
+		       parses, total, val("wakeups"), val("w2s"),
+		       val("allocs"), val("maxrss_kb")
+	}'
+done
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# longtitle.sh builds music with -DVCLOCK and, with the cmus-remote stub
+# of bench/stubs playing tracks with long chinese titles and artists,
+# checks the lines music writes to its slot: a line that fits in MSG_LEN
+# keeps all of it, volume included, a longer one is cut at the start of
+# a character and ends in "…"; either way it is valid utf-8. it prints
+# one line per case and exits 1 if any failed
+#
+#   bench/longtitle.sh
+
+set -e
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+msg_len=$(sed -n 's/^#define MSG_LEN \([0-9]*\).*/\1/p' "$top/config.h")
+now=${NOW:-1760000000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+${CC:-cc} ${CFLAGS:--O2} -DVCLOCK -pthread -o "$tmp/music" \
+	"$top/music.c" "$top/util.c" -lrt
+
+PATH="$top/bench/stubs:$PATH"
+export PATH
+
+# n times the string s
+rep() {
+	awk -v s="$1" -v n="$2" 'BEGIN { while (n-- > 0) printf "%s", s }'
+}
+
+# the first text music writes, for a track called $1 by $2
+line() {
+	BENCH_TITLE="$1" BENCH_ARTIST="$2" \
+	BARBAR_VCLOCK_START="$now" BARBAR_VCLOCK_END=$((now + 10)) \
+		"$tmp/music" 2>&1 >/dev/null |
+	awk '$2 == "w2s" { for (i = 0; i < 5; ++i) sub(/^[^ ]* /, ""); print; exit }'
+}
+
+fail=0
+
+# case name, title, artist, what the line must end with
+check() {
+	text=$(line "$2" "$3")
+	bytes=$(printf '%s' "$text" | wc -c)
+	if [ "$bytes" -ge "$msg_len" ]; then
+		why="$bytes bytes"
+	elif ! printf '%s' "$text" | iconv -f UTF-8 -t UTF-8 >/dev/null 2>&1; then
+		why="invalid utf-8"
+	elif [ "${text%"$4"}" = "$text" ]; then
+		why="doesn't end in $4"
+	else
+		echo "longtitle $1 ok bytes=$bytes"
+		return
+	fi
+	echo "longtitle $1 FAIL $why: $text"
+	fail=1
+}
+
+check fits "$(rep 长 30)" "$(rep 歌 10)" "50%"
+check cut "$(rep 长 60)" "$(rep 歌 60)" "…"
+check cut-ascii "$(rep x 200)" "$(rep 歌 60)" "…"
+
+exit $fail
@@ -0,0 +1,116 @@
+#!/bin/sh
+#
+# spawn.sh builds music and cpom with -DBENCH -DVCLOCK, puts the stubs
+# in bench/stubs first on PATH and drives each module through a fixed
+# simulated period, printing one line per run, e.g.
+#
+#   music cmus=playing secs=3600 spawns=40 execs=40 cmus_remote=20 pactl=20 spawn_ns_total=63627000 spawn_ns_max=2471802 child_cpu_us=59018 child_maxrss_kb=1632 w2s=2 maxrss_kb=1724
+#   cpom poms=4 spawns=16 execs=16 notify_send=8 mpv=8 phases=6 phase_ns_mean=1905880 phase_ns_max=2265325 child_cpu_us=8862 child_maxrss_kb=1632 w2s=14 maxrss_kb=1724
+#
+# spawns counts the module's forks, execs the stub runs they led to;
+# spawn_ns is the wall time of each popen() or system() and phase_ns
+# that from the end of one cpom countdown to the start of the next.
+# mpv is started in a grandchild nobody waits for, so its cpu time is
+# left out of child_cpu_us. every music run lasts SECS simulated seconds
+# with cmus in one of the CMUS states, cpom runs POMS pomodoros;
+# LATENCY makes each stub take that many seconds
+#
+#   CMUS="playing absent" SECS=600 LATENCY=0.01 bench/spawn.sh
+#
+# nothing reaches a running barbar, the virtual clock keeps runs apart
+
+set -e
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+states=${CMUS:-playing paused stopped absent}
+secs=${SECS:-3600}
+poms=${POMS:-4}
+now=${NOW:-1760000000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+for p in music cpom; do
+	${CC:-cc} ${CFLAGS:--O2} -DBENCH -DVCLOCK -pthread -o "$tmp/$p" \
+		"$top/$p.c" "$top/util.c" -lrt
+done
+mkdir -p "$tmp/home"
+
+PATH="$top/bench/stubs:$PATH"
+BENCH_LATENCY=${LATENCY:-}
+export PATH BENCH_LATENCY
+
+# the stub runs logged by a module, by command
+execs() {
+	awk -v cmds="$2" '
+	{ ++n[$1] }
+	END {
+		printf "execs=%d", NR
+		k = split(cmds, c, " ")
+		for (i = 1; i <= k; ++i) {
+			key = c[i]
+			gsub("-", "_", key)
+			printf " %s=%d", key, n[c[i]]
+		}
+	}' "$1"
+}
+
+# the key=value pairs of the module's bench lines: the last of each
+# key wins, spawn and phase times are summed up
+summary() {
+	awk '
+	function val(key,    i) {
+		for (i = 3; i <= NF; ++i)
+			if (index($i, key "=") == 1)
+				return substr($i, length(key) + 2)
+		return ""
+	}
+	$2 == "spawn" {
+		ns = val("ns")
+		total += ns
+		if (ns > max)
+			max = ns
+		cpu = val("child_cpu_us")
+		crss = val("child_maxrss_kb")
+	}
+	$2 == "phase" {
+		++phases
+		ptotal += val("ns")
+		if (val("ns") > pmax)
+			pmax = val("ns")
+	}
+	$2 == "spawn" || $2 == "phase" || $2 == "exit" {
+		spawns = val("spawns")
+		w2s = val("w2s")
+		rss = val("maxrss_kb")
+	}
+	END {
+		printf "spawns=%d %s", spawns, execs
+		if (phases)
+			printf " phases=%d phase_ns_mean=%.0f phase_ns_max=%.0f",
+			       phases, ptotal / phases, pmax
+		else
+			printf " spawn_ns_total=%.0f spawn_ns_max=%.0f",
+			       total, max
+		printf " child_cpu_us=%d child_maxrss_kb=%d w2s=%d " \
+		       "maxrss_kb=%d\n", cpu, crss, w2s, rss
+	}' execs="$2" "$1"
+}
+
+for s in $states; do
+	: > "$tmp/log"
+	BENCH_SPAWN_LOG="$tmp/log" BENCH_CMUS="$s" \
+	BARBAR_VCLOCK_START="$now" BARBAR_VCLOCK_END=$((now + secs)) \
+		"$tmp/music" 2> "$tmp/err" || :
+	printf 'music cmus=%s secs=%s ' "$s" "$secs"
+	summary "$tmp/err" "$(execs "$tmp/log" "cmus-remote pactl")"
+done
+
+: > "$tmp/log"
+HOME="$tmp/home" BENCH_SPAWN_LOG="$tmp/log" BARBAR_VCLOCK_START="$now" \
+	"$tmp/cpom" -F -n "$poms" -t 25 -s 5 -l 15 -f 4 \
+	> /dev/null 2> "$tmp/err" || :
+# mpv is left to init, let the last ones log
+sleep 1
+printf 'cpom poms=%s ' "$poms"
+summary "$tmp/err" "$(execs "$tmp/log" "notify-send mpv")"
@@ -13,6 +13,14 @@
  
  * this approach ensures optimal sleep cycles (called 'naps')
  * and minimizes monitoring overhead
+
+ * large study lists are split at line boundaries into chunks which
+ * are parsed by CCQ_THREADS workers, each keeping its own due count
+ * and the CCQ_TOPK earliest future epochs; those are then k-way merged
+
+ * only the next CCQ_TOPK naps are kept, the later cards are just
+ * counted: once the naps run out the list is parsed again, so memory
+ * does not grow with the number of scheduled cards
  
  */
 
@@ -22,8 +30,10 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,28 +52,63 @@ static const char            done[]    = "每个词都复习了";
 static volatile sig_atomic_t terminate = 0;
 static int                   term_sig  = 0;
 
+#ifdef BENCH
+static unsigned long         bench_allocs  = 0;
+static unsigned long         bench_wakeups = 0;
+#endif
+
 typedef struct {
-	time_t *naps;
-	int     cnt;
-	int     cnt_ft;
+	time_t naps[CCQ_TOPK]; /* gaps between the next future epochs */
+	int    cnt;
+	int    cnt_ft;         /* naps in use */
+	int    rest;           /* future epochs beyond the naps */
+	time_t rest_nap;       /* from the last nap to the earliest of those */
+	char   words[KV_VAL];  /* the first due words, one per line */
 } NapStack;
 
+typedef struct {
+	const char *beg;    /* first line start of the chunk */
+	const char *end;    /* one past the last line start */
+	const char *eof;    /* end of the whole mapping */
+	time_t      now;
+	time_t      top[CCQ_TOPK]; /* earliest future epochs, max-heap, then sorted */
+	int         cnt;
+	int         cnt_ft;   /* epochs in top */
+	int         rest;     /* future epochs that did not make it into top */
+	time_t      rest_min;
+	int         pos;      /* merge cursor into top */
+	char        words[KV_VAL]; /* its first due words, one per line */
+	size_t      wlen;     /* bytes of words in use */
+	int         wfull;    /* a word didn't fit, words takes no more */
+	int         spawned;
+	int         err;
+} Chunk;
+
 static int      cmp_time(const void *a, const void *b);
 static void     die(const char *fmt, ...);
 static void     handle_signal(int sig);
+static void     keep(Chunk *c, time_t epoch);
+static void     keep_word(Chunk *c, const char *line);
+static void    *parse_chunk(void *arg);
 static NapStack parse_due_times(const char *path);
+static void     show(int cnt);
+static void     sift_down(const Chunk *c, int *heap, int n, int i);
 
 int
 main(void)
 {
 	char     path[PATH_MAX], buf[4096];
 	char    *home;
-	int      in_fd, wd, i;
+	int      in_fd, mb_fd, wd, i, ready;
+	uint64_t clicks;
 	struct   sigaction sa;
 	struct   timespec timeout;
 	sigset_t sigmask_all, sigmask_none;
-	struct   pollfd pfd;
+	struct   pollfd pfd[2];
 	NapStack ns;
+#ifdef BENCH
+	struct   timespec t0, t1;
+#endif
 
 	char       rdbuf[11] = {0};
 	const char sl[]      = "/.local/share/ccq/zh"; 
@@ -96,52 +141,84 @@ main(void)
 	if (wd < 0)
 		die(mname, "watch failed");
 
+	/* clicks on the bar ask for a fresh parse */
+	mb_fd = mbox_fd(mname);
+
 	/* parse file */
 restart:
+#ifdef BENCH
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+#endif
 	ns = parse_due_times(path);
-	if (!ns.naps)
-		die(mname, "parse fail");
+#ifdef BENCH
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	bench_report(mname, "parse", "ns=%lld lines=%d due=%d future=%d kept=%d allocs=%lu",
+	             (long long)(t1.tv_sec - t0.tv_sec) * 1000000000LL +
+	             (t1.tv_nsec - t0.tv_nsec),
+	             ns.cnt + ns.cnt_ft + ns.rest, ns.cnt,
+	             ns.cnt_ft + ns.rest, ns.cnt_ft, bench_allocs);
+#endif
 
 	/* print current dues */
-	if (ns.cnt < 1)
-		w2s(mname, done);
-	else
-		w2s(mname, "%d%s", ns.cnt, suffix);
+	show(ns.cnt);
+
+	/* and share them, so cpom needs no parse of its own */
+	kv_put_int(mname, "ccqwatch.due", ns.cnt);
+	kv_put_str(mname, "ccqwatch.words", ns.words);
 
-	/* watch file */
-	pfd.fd = in_fd;
-	pfd.events = POLLIN;
+	/* watch file and clicks, a failed mbox_fd() (-1) is ignored */
+	pfd[0].fd = in_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = mb_fd;
+	pfd[1].events = POLLIN;
 
-	for (i = 0; i < ns.cnt_ft; ++i) {
+	/* one extra nap up to the first card beyond the naps, if any */
+	for (i = 0; i < ns.cnt_ft + (ns.rest > 0); ++i) {
 		if (terminate) {
 			w2s(mname, "%s", strsignal(term_sig));
-			free(ns.naps);
 			break;
 		}
 
-		/* sleep between dues, wake up upon file change or to update bar */
-		timeout.tv_sec = ns.naps[i];
+		/* sleep between dues, wake up upon file change, click
+		 * or to update bar */
+		timeout.tv_sec = i < ns.cnt_ft ? ns.naps[i] : ns.rest_nap;
 		timeout.tv_nsec = 0;
 
-		switch (ppoll(&pfd, 1, &timeout, &sigmask_none)) {
+		ready = clk_ppoll(pfd, 2, &timeout, &sigmask_none);
+		BENCH_INC(bench_wakeups);
+		switch (ready) {
 		case -1:
 			/* error: retry on EINTR */
 			if (errno == EINTR)
 				continue;
 			die("ppoll: %s", strerror(errno));
 		case 0:
+			/* the naps ran out: parse again for the next ones */
+			if (i == ns.cnt_ft)
+				goto restart;
 			/* one nap has elapsed: update bar with new due count */
 			++ns.cnt;
-			w2s(mname, "%d%s", ns.cnt, suffix);
+			show(ns.cnt);
+			kv_put_int(mname, "ccqwatch.due", ns.cnt);
 			break;
 		default:
-			/* file has changed: drain inotify & parse file */
-			read(in_fd, buf, sizeof buf); 
-			free(ns.naps);
+			/* file has changed or was clicked:
+			 * drain inotify and mailbox & parse file */
+			if (pfd[0].revents)
+				read(in_fd, buf, sizeof buf); 
+			if (pfd[1].revents) {
+				read(mb_fd, &clicks, sizeof clicks);
+				while (mbox_take(mname))
+					;
+			}
 			goto restart;
 		}
 	}
 
+#ifdef BENCH
+	bench_report(mname, "exit", "wakeups=%lu allocs=%lu",
+	             bench_wakeups, bench_allocs);
+#endif
 	inotify_rm_watch(in_fd, wd);
 	close(in_fd);
 
@@ -178,96 +255,306 @@ die(const char *fmt, ...)
 	exit(1);
 }
 
-NapStack
-parse_due_times(const char *path)
+/* keeps epoch in the max-heap top if it is among the CCQ_TOPK earliest
+ * seen so far; whatever drops out is only counted */
+static void
+keep(Chunk *c, time_t epoch)
 {
-	char    *addr, *cur;
-	char     rdbuf[11];
-	int      i, fd, cap, cnt, cnt_ft;
-	size_t   length;
-	struct   stat sb;
-	time_t  *naps, *notdues;
-	time_t   gap, now;
-	NapStack result;
-
-	result.naps   = NULL;
-	result.cnt    = 0;
-	result.cnt_ft = 0;
-
-	/* open study list, mmap it */
-	fd = open(path, O_RDONLY);
-	if (fd < 0 || fstat(fd, &sb) < 0)
-		die("open/fstat");
+	time_t *h = c->top, out, tmp;
+	int     i, l, r, m, p;
+
+	if (c->cnt_ft < CCQ_TOPK) {
+		for (i = c->cnt_ft++; i > 0 && h[p = (i - 1) / 2] < epoch; i = p)
+			h[i] = h[p];
+		h[i] = epoch;
+		return;
+	}
 
-	length = sb.st_size;
-	addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
-	if (addr == MAP_FAILED)
-		die("mmap");
+	out = epoch;
+	if (epoch < h[0]) {
+		out  = h[0];
+		h[0] = epoch;
+		for (i = 0;; i = m) {
+			l = 2 * i + 1;
+			r = l + 1;
+			m = i;
+			if (l < CCQ_TOPK && h[l] > h[m])
+				m = l;
+			if (r < CCQ_TOPK && h[r] > h[m])
+				m = r;
+			if (m == i)
+				break;
+			tmp  = h[i];
+			h[i] = h[m];
+			h[m] = tmp;
+		}
+	}
+	if (!c->rest || out < c->rest_min)
+		c->rest_min = out;
+	++c->rest;
+}
 
-	/* gather dues and notdues */
-	cap = 512;
-	notdues = malloc(cap * sizeof(time_t));
-	if (!notdues)
-		die("malloc notdues");
+/* appends the word of a "epoch|x|word|y" line to the chunk's words,
+ * as long as they fit */
+static void
+keep_word(Chunk *c, const char *line)
+{
+	const char *w, *end = c->eof;
+	size_t len;
+
+	if (c->wfull)
+		return;
+	/* the mapping isn't terminated, so every scan is bounded */
+	w = line;
+	for (int f = 0; f < 2; ++f) {
+		while (w < end && *w != '|' && *w != '\n')
+			++w;
+		if (w >= end || *w != '|')
+			return;
+		++w;
+	}
+	for (len = 0; w + len < end && w[len] != '|' && w[len] != '\n'; ++len)
+		;
+	if (len == 0)
+		return;
+	if (c->wlen + len + 1 >= sizeof(c->words)) {
+		c->wfull = 1;
+		return;
+	}
+	memcpy(c->words + c->wlen, w, len);
+	c->wlen += len;
+	c->words[c->wlen++] = '\n';
+	c->words[c->wlen] = '\0';
+}
 
-	now = time(NULL);
-	cnt = cnt_ft = 0;
-	cur = addr;
-	while (cur + 10 < addr + length) {
-		char   *nl;
-		time_t  epoch;
-		time_t *tmp;
+/* parses the lines starting in [beg, end) into a local count and top */
+static void *
+parse_chunk(void *arg)
+{
+	Chunk      *c = arg;
+	const char *cur, *nl;
+	char        rdbuf[11];
+	time_t      epoch;
 
-		if (terminate)
-			die("%s", strsignal(term_sig));
+	cur = c->beg;
+	while (cur < c->end && cur + 10 < c->eof) {
+		if (terminate) {
+			c->err = 1;
+			return NULL;
+		}
 
 		/* get epoch */
 		memcpy(rdbuf, cur, 10);
 		rdbuf[10] = '\0';
 		epoch = (time_t)strtol(rdbuf, NULL, 10);
 
-		/* bound check */
-		if (cnt_ft >= cap) {
-			cap *= 2;
-			tmp  = realloc(notdues, cap * sizeof(time_t));
-			if (!tmp)
-				die("realloc notdues");
-			notdues = tmp;
-		}
-
 		/* process as due / notdue */
-		if (epoch <= now)
-			++cnt;
-		else 
-			notdues[cnt_ft++] = epoch;
+		if (epoch <= c->now) {
+			++c->cnt;
+			keep_word(c, cur);
+		} else
+			keep(c, epoch);
 
 		/* find new line of break on EOF */
-		nl = memchr(cur, '\n', addr + length - cur);
-		if (!nl) 
+		nl = memchr(cur, '\n', c->eof - cur);
+		if (!nl)
 			break;
 
 		/* point to start of new line */
 		cur = nl + 1;
 	}
 
+	qsort(c->top, c->cnt_ft, sizeof(time_t), cmp_time);
+	return NULL;
+}
+
+/* restores the min-heap of top heads below index i */
+static void
+sift_down(const Chunk *c, int *heap, int n, int i)
+{
+	int l, r, m, tmp;
+
+	for (;;) {
+		l = 2 * i + 1;
+		r = l + 1;
+		m = i;
+		if (l < n && c[heap[l]].top[c[heap[l]].pos] <
+		             c[heap[m]].top[c[heap[m]].pos])
+			m = l;
+		if (r < n && c[heap[r]].top[c[heap[r]].pos] <
+		             c[heap[m]].top[c[heap[m]].pos])
+			m = r;
+		if (m == i)
+			return;
+		tmp     = heap[i];
+		heap[i] = heap[m];
+		heap[m] = tmp;
+		i = m;
+	}
+}
+
+NapStack
+parse_due_times(const char *path)
+{
+	char      *addr, *beg, *end, *eof, *nl, *w;
+	int        i, j, n, fd, nthr;
+	int       *heap;
+	size_t     length;
+	struct     stat sb;
+	pthread_t *tids;
+	Chunk     *chunks, *c;
+	time_t     gap, now, first;
+	NapStack   result;
+
+	result.cnt  = 0;
+	result.rest = 0;
+	result.words[0] = '\0';
+
+	/* open study list, mmap it */
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb) < 0)
+		die("open/fstat");
+
+	length = sb.st_size;
+	addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED)
+		die("mmap");
+
+	/* small lists are not worth a thread each */
+	nthr = CCQ_THREADS > 0 ? CCQ_THREADS
+	                       : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if ((size_t)nthr > length / CCQ_CHUNK_MIN)
+		nthr = length / CCQ_CHUNK_MIN;
+	if (nthr < 1)
+		nthr = 1;
+
+	chunks = calloc(nthr, sizeof(Chunk));
+	BENCH_INC(bench_allocs);
+	tids   = calloc(nthr, sizeof(pthread_t));
+	BENCH_INC(bench_allocs);
+	heap   = calloc(nthr, sizeof(int));
+	BENCH_INC(bench_allocs);
+	if (!chunks || !tids || !heap)
+		die("calloc chunks");
+
+	/* split at newline boundaries: each line start is in one chunk */
+	now = clk_now();
+	eof = addr + length;
+	beg = addr;
+	for (i = 0; i < nthr; ++i) {
+		end = (i == nthr - 1) ? eof : addr + length * (i + 1) / nthr;
+		if (end <= beg) {
+			end = beg;
+		} else if (end < eof) {
+			nl  = memchr(end, '\n', eof - end);
+			end = nl ? nl + 1 : eof;
+		}
+
+		c = &chunks[i];
+		c->beg = beg;
+		c->end = end;
+		c->eof = eof;
+		c->now = now;
+		beg = end;
+	}
+
+	/* chunk 0 is parsed on this thread, or all of them if spawning fails */
+	for (i = 1; i < nthr; ++i) {
+		chunks[i].spawned = pthread_create(&tids[i], NULL,
+		                    parse_chunk, &chunks[i]) == 0;
+		if (!chunks[i].spawned)
+			parse_chunk(&chunks[i]);
+	}
+	parse_chunk(&chunks[0]);
+	for (i = 1; i < nthr; ++i)
+		if (chunks[i].spawned)
+			pthread_join(tids[i], NULL);
+
 	munmap(addr, length);
 	close(fd);
 
-	qsort(notdues, cnt_ft, sizeof(time_t), cmp_time);
+	for (i = 0; i < nthr; ++i) {
+		if (chunks[i].err) {
+			if (terminate)
+				die("%s", strsignal(term_sig));
+			die("parse chunk");
+		}
+		result.cnt += chunks[i].cnt;
+	}
 
-	naps = malloc(cnt_ft * sizeof(time_t));
-	if (!naps)
-		die("naps malloc");
+	/* due words in file order, whole lines as long as they fit;
+	 * after a chunk that ran out of room, later words aren't next */
+	for (i = 0, j = 0; i < nthr; ++i) {
+		c = &chunks[i];
+		for (w = c->words; w < c->words + c->wlen; w = nl + 1) {
+			nl = memchr(w, '\n', c->words + c->wlen - w);
+			if (j + (nl - w) + 1 >= (int)sizeof(result.words))
+				break;
+			memcpy(result.words + j, w, nl - w + 1);
+			j += nl - w + 1;
+		}
+		if (w < c->words + c->wlen || c->wfull)
+			break;
+	}
+	result.words[j] = '\0';
+
+	/* k-way merge of the sorted tops, the first CCQ_TOPK become naps */
+	n = 0;
+	for (i = 0; i < nthr; ++i)
+		if (chunks[i].cnt_ft > 0)
+			heap[n++] = i;
+	for (i = n / 2 - 1; i >= 0; --i)
+		sift_down(chunks, heap, n, i);
 
 	gap = now;
-	for (int i = 0; i < cnt_ft; ++i) {
-		naps[i] = notdues[i] - gap;
-		gap += naps[i];
+	for (j = 0; n > 0 && j < CCQ_TOPK; ++j) {
+		c = &chunks[heap[0]];
+		result.naps[j] = c->top[c->pos++] - gap;
+		gap += result.naps[j];
+		if (c->pos == c->cnt_ft)
+			heap[0] = heap[--n];
+		sift_down(chunks, heap, n, 0);
+	}
+	result.cnt_ft = j;
+
+	/* the rest is only counted, and where it starts remembered */
+	first = 0;
+	for (i = 0; i < nthr; ++i) {
+		c = &chunks[i];
+		if (c->pos < c->cnt_ft) {
+			result.rest += c->cnt_ft - c->pos;
+			if (!first || c->top[c->pos] < first)
+				first = c->top[c->pos];
+		}
+		if (c->rest) {
+			result.rest += c->rest;
+			if (!first || c->rest_min < first)
+				first = c->rest_min;
+		}
 	}
-	free(notdues);
+	result.rest_nap = result.rest ? first - gap : 0;
+
+	free(chunks);
+	free(tids);
+	free(heap);
 
-	result.naps = naps;
-	result.cnt = cnt;
-	result.cnt_ft = cnt_ft;
 	return result;
 }
+
+/* shows the due count, followed by a sparkline of its last CCQ_SPARK
+ * values, which barbar draws from the history kept in the segment */
+static void
+show(int cnt)
+{
+	char label[MSG_LEN];
+
+	w2s_sample(mname, cnt);
+	if (cnt < 1) {
+		w2s(mname, done);
+	} else if (CCQ_SPARK > 0) {
+		snprintf(label, sizeof(label), "%d%s ", cnt, suffix);
+		w2s_spark(mname, CCQ_SPARK, label);
+	} else {
+		w2s(mname, "%d%s", cnt, suffix);
+	}
+}
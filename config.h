@@ -9,20 +9,69 @@ static const char *MODULES[] = {
 	"music",
 	"cpom", 
 	"ccqwatch",
+	"todo",
+	"sysstat",
+	"power",
 	"pomwatch", 
 	"bartime" 
 };
 
-/* maximum individual module string size */
-#define MSG_LEN 64
-/* maximum total output string size */
-#define MAX_LEN 256
+/* locale for clock slots, which barbar itself renders */
+static const char TIME_LOCALE[] = "zh_CN.UTF-8";
+
+/* barbar keeps the last slots in $HOME/SNAP_FILE, saved at most every
+ * SNAP_S seconds and on exit, and shows them until their producers
+ * refresh them; slots older than SNAP_MAX_AGE seconds are not restored */
+static const char SNAP_FILE[] = "/.cache/barbar.slots";
+static const int SNAP_S = 60;
+static const int SNAP_MAX_AGE = 24 * 60 * 60;
+/* shown before a restored slot until its producer rewrites it */
+static const char STALE_MARK[] = "~";
+
+/* width of the bar in display columns: when the modules don't fit,
+ * they switch to their short form or get elided with "…" */
+#define BAR_COLS 160
+/* column budget of each module, in MODULES order:
+ * never wider than max (0 = unbounded), never elided below min */
+static const struct { int min, max; } BUDGETS[] = {
+	{ 12, 48 }, /* music */
+	{  5,  0 }, /* cpom */
+	{  4,  0 }, /* ccqwatch */
+	{  4,  0 }, /* todo */
+	{ 14, 48 }, /* sysstat */
+	{  3,  0 }, /* power */
+	{  5,  0 }, /* pomwatch */
+	{ 11,  0 }, /* bartime */
+};
+
+/* maximum individual module string size, in bytes: room for the
+ * widest budget above in 3-byte characters, longer text is cut */
+#define MSG_LEN 256
+/* maximum total output string size, BAR_COLS of any utf-8 and SEPs */
+#define MAX_LEN 1024
 /* interestingly, this needs to be a #define for the compiler to
  * accept char slots[NUM_MODULES][MSG_LEN] as constant-size */
 
 
-/* music module refresh rate */
-static const int MUSIC_S = 1;
+/* music module base refresh rate, used after any state change */
+static const int MUSIC_S = 2;
 static const int MUSIC_NS = 0;
+/* longest music nap while cmus is absent, stopped or paused,
+ * and while waiting for the current track to end */
+static const int MUSIC_MAX_S = 300;
+
+/* ccqwatch parser threads, 0 uses every online cpu */
+static const int CCQ_THREADS = 0;
+/* study lists below this many bytes per thread are parsed inline */
+#define CCQ_CHUNK_MIN (1 << 20)
+/* ccqwatch naps kept ahead, later cards are found by parsing again */
+#define CCQ_TOPK 64
+/* bars of due count history after ccqwatch's count, 0 for none */
+static const int CCQ_SPARK = 8;
+
+/* seconds between sysstat samples, cpu and network are averaged over them */
+static const int SYSSTAT_S = 2;
+/* seconds between power's re-reads in case a uevent got lost */
+static const int POWER_S = 600;
 
 #endif
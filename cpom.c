@@ -30,6 +30,11 @@ static const char over_title[]        = "完成";
 static volatile sig_atomic_t terminate = 0;
 static int                   term_sig  = 0;
 
+#ifdef BENCH
+/* end of the last countdown, a phase transition lasts until the next */
+static struct timespec       bench_phase_end;
+#endif
+
 typedef struct PomState {
         int  file_flag;
         char start_msg[128];
@@ -46,6 +51,7 @@ static void   play_sound(const char *filepath);
 static void   pomodoro(int n, float ptime, float sbktime, float lbktime, int frq, PomState *state);
 static void   printhelp(const char *progname);
 static char **get_words(int *total);
+static const char *pick_word(char *buf, size_t len);
 static void   handle_signal(int sig);
 
 int 
@@ -64,10 +70,11 @@ main(int argc, char *argv[])
         int opt;
 	char *endptr;
 
+	/* no SA_RESTART: waits in countdown_timer() must see SIGINT */
 	struct sigaction sa = {0};
 	sa.sa_handler = handle_signal;
 	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = SA_RESTART;
+	sa.sa_flags = 0;
 	sigaction(SIGINT,  &sa, NULL);
 
         while ((opt = getopt(argc, argv, "n:t:s:l:f:Fh")) != -1) {
@@ -138,14 +145,17 @@ main(int argc, char *argv[])
 static void 
 notify(const char *title, const char *msg)
 {
-        char cmd[256];
+        char cmd[2 * KV_VAL];
         snprintf(cmd, sizeof(cmd), "notify-send '%s' '%s'", title, msg);
+        BENCH_SPAWN_BEGIN();
         system(cmd);
+        BENCH_SPAWN_END(mname, cmd);
 }
 
 static void
 play_sound(const char *file)
 {
+    BENCH_SPAWN_BEGIN();
     pid_t pid = fork();
     if (pid == -1) { 
 	    perror("fork"); 
@@ -169,6 +179,8 @@ play_sound(const char *file)
     /* parent reaps first child, grand-child is reparented to init → no zombie */
     while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
         ;
+    /* up to the hand-off to init, mpv itself isn't waited for */
+    BENCH_SPAWN_END(mname, "mpv");
 }
 
 /* initialize runtime strings in state */
@@ -205,21 +217,55 @@ countdown_timer(int seconds, PomState *state)
 {
         char line[12];
 
-        for (int elapsed = 0; elapsed < seconds; ++elapsed) {
-                if (terminate)
-			break;
-
-                int left = seconds - elapsed;
-                snprintf(line, sizeof line, "%02u:%02u", left / 60, left % 60);
-
-                if (state->file_flag)
-                        w2s(mname, line);
-                else {
+#ifdef BENCH
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (bench_phase_end.tv_sec)
+                bench_report(mname, "phase", "ns=%lld spawns=%lu",
+                             (long long)(now.tv_sec - bench_phase_end.tv_sec) *
+                             1000000000LL +
+                             (now.tv_nsec - bench_phase_end.tv_nsec),
+                             bench_spawns);
+#endif
+
+        if (state->file_flag) {
+                /* barbar renders the countdown itself: publish once
+                 * and sleep through the phase */
+                const char *fmt = seconds < 3600 ? "%M:%S" : "%H:%M:%S";
+                time_t deadline = clk_now() + seconds;
+                time_t left;
+
+                w2s_countdown(mname, deadline, fmt);
+                while (!terminate && (left = deadline - clk_now()) > 0) {
+                        struct timespec ts = { .tv_sec = left };
+                        if (mbox_wait(mname, &ts) != 1)
+                                continue;
+
+                        /* a left click pauses, the next one resumes */
+                        left = deadline - clk_now();
+                        w2s(mname, "暂停 %02ld:%02ld",
+                            (long)left / 60, (long)left % 60);
+                        while (!terminate && mbox_wait(mname, NULL) != 1)
+                                ;
+                        deadline = clk_now() + left;
+                        w2s_countdown(mname, deadline, fmt);
+                }
+        } else {
+                for (int elapsed = 0; elapsed < seconds; ++elapsed) {
+                        if (terminate)
+                                break;
+
+                        int left = seconds - elapsed;
+                        snprintf(line, sizeof line, "%02u:%02u",
+                                 left / 60, left % 60);
                         printf("\r%s", line);
                         fflush(stdout);
+                        clk_sleep(1);
                 }
-                sleep(1);
         }
+#ifdef BENCH
+        clock_gettime(CLOCK_MONOTONIC, &bench_phase_end);
+#endif
 	/* TODO: remove the below and handle blocking signal handling correctly */
 	/* so that the loop check works */
 	if (terminate) {
@@ -241,9 +287,7 @@ static void
 pomodoro(int n, float ptime, float sbktime, float lbktime, int frq, 
          PomState *state)
 {
-	int total = 0;
-	char **words = get_words(&total);
-	srand(time(NULL)); 
+	srand(clk_now()); 
 
         for (int i = 0; i < n; ++i) {
                 play_sound(state->startfp);
@@ -259,8 +303,9 @@ pomodoro(int n, float ptime, float sbktime, float lbktime, int frq,
                 }
                 play_sound(state->endfp);
                 
-		char bk_msg[128];
-		char *word = words[rand() % total];
+		char bk_msg[KV_VAL + 64];
+		char wbuf[KV_VAL]; /* any word ccqwatch shares */
+		const char *word = pick_word(wbuf, sizeof(wbuf));
 		if ((i + 1) % frq == 0) {
 			snprintf(bk_msg, sizeof(bk_msg),
 					"[%d/%d] 长休: %.1f m\n"
@@ -278,7 +323,6 @@ pomodoro(int n, float ptime, float sbktime, float lbktime, int frq,
 		}
 
         }
-	free(words);
 }
 
 
@@ -346,6 +390,35 @@ static char **get_words(int *total)
 	return words;
 }
 
+/* a random word for the break: one of the due words ccqwatch shares,
+ * or else any word of the study list, which is then parsed once */
+static const char *
+pick_word(char *buf, size_t len)
+{
+	static char **words = NULL;
+	static int total = -1;
+	const char *p, *nl;
+	struct kv e;
+	int n = 0, k;
+
+	if (kv_get("ccqwatch.words", &e) && e.type == KV_STR) {
+		for (p = e.v.s; *p; ++p)
+			n += *p == '\n';
+		if (n > 0) {
+			k = rand() % n;
+			for (p = e.v.s; k--; p = strchr(p, '\n') + 1)
+				;
+			nl = strchr(p, '\n');
+			snprintf(buf, len, "%.*s", (int)(nl - p), p);
+			return buf;
+		}
+	}
+
+	if (total < 0)
+		words = get_words(&total);
+	return total > 0 ? words[rand() % total] : "";
+}
+
 static void  
 handle_signal(int sig)
 {
@@ -1,13 +1,16 @@
-#define _POSIX_C_SOURCE 200809L /* strsignal */
+#define _XOPEN_SOURCE 700 /* strsignal */
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <locale.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <time.h>
@@ -16,51 +19,114 @@
 #include "config.h"
 #include "util.h"
 
+/* held by the running barbar, next to SHM_NAME */
+static const char LOCK_NAME[] = "/shm_barbar.lock";
+
+#define SNAP_MAGIC 0x70736262u /* "bbsp" */
+
+/* the contents of SNAP_FILE, what barbar keeps of the slots across
+ * restarts; a slot is only restored into the module it was saved from */
+struct snapshot {
+	uint32_t      magic;  /* SNAP_MAGIC */
+	uint32_t      layout; /* sizeof(struct snapshot) */
+	char          names[NUM_MODULES][32];
+	struct slot   slots[NUM_MODULES];
+	struct hist   hist[NUM_MODULES];
+};
+
 static volatile sig_atomic_t terminate = 0;
 static volatile sig_atomic_t term_sig = 0;
 
-static void handle_signal(int sig);
+static void  *wait_signal(void *arg);
+static void   snap_copy(const struct shared_data *shm_data,
+                        struct snapshot *snap);
+static int    snap_load(struct shared_data *shm_data);
+static void   set_paused(struct shared_data *shm_data, uint32_t paused);
+static int    snap_path(char *buf, size_t len);
+static void   snap_save(const struct snapshot *snap);
 
 int
 main(void)
 {
-	struct sigaction sa = {0};
-        sa.sa_handler = handle_signal;
-        sigemptyset(&sa.sa_mask);
-        if (sigaction(SIGINT,  &sa, NULL) == -1 ||
-            sigaction(SIGTERM, &sa, NULL) == -1)
-		log_err("sigaction");
-
-	bool is_creator = false;
+	/* a signal handler can't wake a condition wait, so signals are
+	 * blocked here and taken by wait_signal() on its own thread */
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGUSR1);
+	sigaddset(&sigs, SIGUSR2);
+	if (pthread_sigmask(SIG_BLOCK, &sigs, NULL) != 0)
+		log_err("sigmask");
+
+	/* clock slots are rendered here, in TIME_LOCALE;
+	 * if it is missing strftime just falls back to "C" */
+	setlocale(LC_TIME, TIME_LOCALE);
+	/* display widths need a utf-8 LC_CTYPE */
+	if (!setlocale(LC_CTYPE, "") || MB_CUR_MAX == 1)
+		setlocale(LC_CTYPE, "C.UTF-8");
+
 	size_t shm_size = sizeof(struct shared_data);
+	uint32_t gen = 0;
 	int shm_fd;
 
+	/* only one barbar at a time: a second one would retire the segment
+	 * from under the first. the lock goes with the process, however it
+	 * ends, and is kept open until then */
+	int lock_fd = shm_open(LOCK_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (lock_fd == -1)
+		log_err("can't open %s", LOCK_NAME);
+	if (flock(lock_fd, LOCK_EX | LOCK_NB) == -1)
+		log_err("barbar is already running");
+
 	/* we want to create a fresh memory region for SHM_NAME */
 open_shm:
 	shm_fd = shm_open(SHM_NAME, 
 			O_RDWR | O_CREAT | O_EXCL, 0600);
-	if (shm_fd != -1) {
-		/* all good */
-		is_creator = true;
-	} else if (errno == EEXIST) {
-		/* already exists: try to use it and continue if it works,
-		 * taking into consideration we are not the creators */
+	if (shm_fd == -1 && errno == EEXIST) {
+		/* already exists: with the lock ours, it was left by a
+		 * barbar that didn't exit cleanly, whose condition
+		 * variable may still count its dead waiter and can't be
+		 * reused. retire it so producers
+		 * move to ours, then delete it and retry */
 		shm_fd = shm_open(SHM_NAME, O_RDWR, 0);
 		
-		if (shm_fd == -1 && errno == EACCES) {
-			/* permissions error from stale process:
-			 * we delete and retry */
-			if (shm_unlink(SHM_NAME) == -1)
-				log_err("unlink stale shm");
-			goto open_shm;
-		} else if (shm_fd == -1)
+		if (shm_fd == -1 && errno != EACCES)
 			log_err("can neither create new shm nor access old");
-	} else 
+
+		/* on a permissions error from a stale process
+		 * we only delete it */
+		struct stat sb;
+		if (shm_fd != -1 && fstat(shm_fd, &sb) == 0 &&
+		    sb.st_size >= (off_t)shm_size) {
+			struct shared_data *old = mmap(NULL, shm_size,
+			            PROT_READ | PROT_WRITE, MAP_SHARED,
+			            shm_fd, 0);
+			if (old != MAP_FAILED) {
+				if (old->magic == SHM_MAGIC &&
+				    old->layout == shm_size)
+					gen = old->generation;
+				__atomic_store_n(&old->generation, 0,
+				                 __ATOMIC_RELEASE);
+				futex_wake(&old->generation);
+				__atomic_store_n(&old->paused, 0,
+				                 __ATOMIC_RELEASE);
+				futex_wake(&old->paused);
+				for (int i = 0; i < (int)NUM_MODULES; ++i)
+					futex_wake(&old->mbox[i].seq);
+				munmap(old, shm_size);
+			}
+		}
+		if (shm_fd != -1)
+			close(shm_fd);
+		if (shm_unlink(SHM_NAME) == -1)
+			log_err("unlink stale shm");
+		goto open_shm;
+	} else if (shm_fd == -1)
 		log_err("couldn't create a new shm");
 
-	/* only resize shared memory on first run */
-	if (is_creator && (ftruncate(shm_fd, shm_size) == -1))
-			log_err("ftruncate");
+	if (ftruncate(shm_fd, shm_size) == -1)
+		log_err("ftruncate");
 
 	struct shared_data *shm_data = mmap(NULL, shm_size, 
 			              PROT_READ | PROT_WRITE,
@@ -68,58 +134,92 @@ open_shm:
 	if (shm_data == MAP_FAILED)
 		log_err("mmap");
 
-	/* on first run, initialize everything */
-	if (is_creator) {
-		/* initialize the mutex and conditional variable */
-		pthread_mutexattr_t mattr;
-		pthread_condattr_t cattr;
-		pthread_mutexattr_init(&mattr);
-		pthread_condattr_init(&cattr);
-
-		/* we want them shared across processes, not private */
-		pthread_mutexattr_setpshared(&mattr, 
-				    PTHREAD_PROCESS_SHARED);
-		pthread_condattr_setpshared(&cattr, 
-				   PTHREAD_PROCESS_SHARED);
-
-		/* point them at the shared memory struct */
-		pthread_mutex_init(&shm_data->mutex, &mattr);
-		pthread_cond_init(&shm_data->cond, &cattr);
-
-		/* we've transferred the attributes to the struct
-		 * and don't need these anymore */
-		pthread_mutexattr_destroy(&mattr);
-		pthread_condattr_destroy(&cattr);
-
-		/* start at version 0 */
-		shm_data->version = 0;
-
-		/* zero out slots */
-		memset(shm_data->slots, 0, sizeof(shm_data->slots));
-	}
+	/* initialize the mutex and conditional variable */
+	pthread_mutexattr_t mattr;
+	pthread_condattr_t cattr;
+	pthread_mutexattr_init(&mattr);
+	pthread_condattr_init(&cattr);
+
+	/* we want them shared across processes, not private */
+	pthread_mutexattr_setpshared(&mattr, 
+			    PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setpshared(&cattr, 
+			   PTHREAD_PROCESS_SHARED);
+
+	/* point them at the shared memory struct */
+	pthread_mutex_init(&shm_data->mutex, &mattr);
+	pthread_cond_init(&shm_data->cond, &cattr);
+
+	/* we've transferred the attributes to the struct
+	 * and don't need these anymore */
+	pthread_mutexattr_destroy(&mattr);
+	pthread_condattr_destroy(&cattr);
+
+	/* start at version 0, and shown */
+	shm_data->version = 0;
+	shm_data->paused = 0;
+
+	/* zero out slots */
+	memset(shm_data->slots, 0, sizeof(shm_data->slots));
+
+	/* show the slots of the last run until their producers write,
+	 * so the first line is complete; that bumps the version */
+	if (snap_load(shm_data))
+		shm_data->version = 1;
+
+	shm_data->magic  = SHM_MAGIC;
+	shm_data->layout = shm_size;
+
+	/* publishing the generation last opens the segment to producers,
+	 * which attach and publish their latest value */
+	++gen;
+	__atomic_store_n(&shm_data->generation, gen ? gen : 1,
+	                 __ATOMIC_RELEASE);
+
+	pthread_t sig_tid;
+	if (pthread_create(&sig_tid, NULL, wait_signal, shm_data) != 0)
+		log_err("signal thread");
 
 	/* main loop */
-	const size_t sep_len = strlen(SEP);
+	static struct cell cells[NUM_MODULES];
+	static struct snapshot snap;
 	unsigned long local_version = 0; /* last processed version */
+	unsigned long saved_version = shm_data->version;
+	time_t saved = time(NULL);
 	char out_str[MAX_LEN];
 
 	while (!terminate) {
-		/* initialize string */
-                size_t cur_len = 0; 
-		out_str[0] = '\0';
-
 		/* lock the mutex */
 		pthread_mutex_lock(&shm_data->mutex);
 
 		/* start the conditional wait within predicate loop:
 		 * 	wait as long as not terminate +
-		 * 	versions match
+		 * 	paused, or versions match +
+		 * 	no countdown or clock slot needs a new render
 		 */
-		while (!terminate && shm_data->version == local_version) {
+		while (!terminate && (shm_data->paused ||
+		                      shm_data->version == local_version)) {
+			/* not time(), which may lag the clock the timed wait
+			 * uses by a tick and make it return early */
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			time_t tick = shm_data->paused ? 0 :
+			              next_tick(shm_data, ts.tv_sec);
+
 			/* unlock mutex, put thread to sleep, and
 			 * upon wake up lock (for this process) */
-			pthread_cond_wait(&shm_data->cond, 
-				   &shm_data->mutex);
+			if (!tick) {
+				pthread_cond_wait(&shm_data->cond, 
+					   &shm_data->mutex);
+				continue;
+			}
+
+			/* typed slots: sleep at most until their next tick */
+			ts.tv_sec  = tick;
+			ts.tv_nsec = 0;
+			if (pthread_cond_timedwait(&shm_data->cond,
+			                   &shm_data->mutex, &ts) == ETIMEDOUT)
+				break;
 		}
 
 		/* thread wakes up! */
@@ -128,68 +228,213 @@ open_shm:
 			pthread_mutex_unlock(&shm_data->mutex);
 			break;
 		}
+		trace_ev(TR_WAKE, shm_data->version);
+		trace_ev(TR_COMPOSE_BEGIN, shm_data->version);
 
-		/* gather all the slots' strings */
-		char *dst = out_str;
-                for (int i = 0; i < (int)NUM_MODULES; ++i) {
-                        char *slot = shm_data->slots[i];
-                        if (slot[0] == '\0')
-                                continue;
-
-			size_t slot_len = strlen(slot);
-			/* add separator length if not first module */
-			size_t need = slot_len + (cur_len ? sep_len : 0);
-
-			/* overflow guard: log we've overflown,
-			 * and only print the module strings that fit */
-			if (cur_len + need >= MAX_LEN) {
-				log_err("string too long\n");
-				break;
-			}
-
-			/* first write separator to string if not first module */
-			if (cur_len > 0) {
-				/* the separator is defined in config.h */
-				memcpy(dst, SEP, sep_len);
-				dst += sep_len;
-				cur_len += sep_len;
-			}
-			/* then write the full string to memory */
-			memcpy(dst, slot, slot_len);
-			dst += slot_len;
-			cur_len += slot_len;
+		/* copy the slots out, rendering countdown, clock and
+		 * sparkline slots as of now, so the layout runs without holding the lock */
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		for (int i = 0; i < (int)NUM_MODULES; ++i) {
+			cells[i].mod = i;
+			render_cell(&cells[i], &shm_data->slots[i],
+			            &shm_data->hist[i], now.tv_sec);
 		}
 
-		/* null terminate */
-		*dst = '\0';
 		/* update version */
 		local_version = shm_data->version;
+
+		/* changes reach SNAP_FILE at most every SNAP_S seconds */
+		bool save = local_version != saved_version &&
+		            now.tv_sec >= saved + SNAP_S;
+		if (save)
+			snap_copy(shm_data, &snap);
 		/* we're done: unlock the mutex again */
 		pthread_mutex_unlock(&shm_data->mutex);
 
+		size_t cur_len = layout(cells, NUM_MODULES, out_str,
+		                        sizeof(out_str));
+		trace_ev(TR_COMPOSE_END, cur_len);
+
 		/* and finally output the string, if not empty
 		 * we use write() to ensure we bypass any buffering */
-		if (out_str[0] != '\0')
-			write(1, out_str, cur_len);
+		if (out_str[0] != '\0') {
+			trace_ev(TR_WRITE_BEGIN, cur_len);
+			trace_ev(TR_WRITE_END, write(1, out_str, cur_len));
+		}
 		/* we assume this call works, and don't check for bytes written */
+
+		if (save) {
+			snap_save(&snap);
+			saved_version = local_version;
+			saved = now.tv_sec;
+		}
 	}
 
+	/* keep whatever changed since the last save */
+	pthread_mutex_lock(&shm_data->mutex);
+	bool save = shm_data->version != saved_version;
+	if (save)
+		snap_copy(shm_data, &snap);
+	pthread_mutex_unlock(&shm_data->mutex);
+	if (save)
+		snap_save(&snap);
+
 	/* this part is only reached upon signal termination 
 	 * update with signal name and clean up everything */
         printf("%s", strsignal(term_sig));
 
+	/* retire the segment so producers let go of it,
+	 * including those waiting for clicks or a resume */
+	__atomic_store_n(&shm_data->generation, 0, __ATOMIC_RELEASE);
+	futex_wake(&shm_data->generation);
+	__atomic_store_n(&shm_data->paused, 0, __ATOMIC_RELEASE);
+	futex_wake(&shm_data->paused);
+	for (int i = 0; i < (int)NUM_MODULES; ++i)
+		futex_wake(&shm_data->mbox[i].seq);
+
         if (munmap(shm_data, shm_size) == -1)
 		log_err("munmap");
 	if (shm_unlink(SHM_NAME) == -1)
 		log_err("shm_unlink");
         close(shm_fd);
+	close(lock_fd);
 
         return 0;
 }
 
-void
-handle_signal(int sig)
+/* $HOME/SNAP_FILE, 0 without a HOME */
+static int
+snap_path(char *buf, size_t len)
+{
+	const char *home = getenv("HOME");
+
+	if (!home || !*home)
+		return 0;
+	return snprintf(buf, len, "%s%s", home, SNAP_FILE) < (int)len;
+}
+
+/* fills snap from the segment, called with the mutex held */
+static void
+snap_copy(const struct shared_data *shm_data, struct snapshot *snap)
+{
+	snap->magic  = SNAP_MAGIC;
+	snap->layout = sizeof(*snap);
+	for (int i = 0; i < (int)NUM_MODULES; ++i)
+		strncpy(snap->names[i], MODULES[i], sizeof(snap->names[i]));
+	memcpy(snap->slots, shm_data->slots, sizeof(snap->slots));
+	memcpy(snap->hist, shm_data->hist, sizeof(snap->hist));
+}
+
+/* restores the slots saved by the last run into the fresh segment,
+ * marked stale, and returns how many */
+static int
+snap_load(struct shared_data *shm_data)
 {
+	static struct snapshot snap;
+	char path[PATH_MAX];
+	time_t now = time(NULL);
+	int fd, n = 0;
+	ssize_t got;
+
+	if (!snap_path(path, sizeof(path)))
+		return 0;
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return 0;
+	got = read(fd, &snap, sizeof(snap));
+	close(fd);
+	if (got != (ssize_t)sizeof(snap) || snap.magic != SNAP_MAGIC ||
+	    snap.layout != sizeof(snap))
+		return 0;
+
+	for (int i = 0; i < (int)NUM_MODULES; ++i) {
+		struct slot *s = &snap.slots[i];
+
+		if (strncmp(snap.names[i], MODULES[i], sizeof(snap.names[i])) ||
+		    !s->ver || now - s->updated > SNAP_MAX_AGE)
+			continue;
+		s->ver   = 1;
+		s->stale = 1;
+		memcpy(&shm_data->slots[i], s, sizeof(*s));
+		memcpy(&shm_data->hist[i], &snap.hist[i], sizeof(snap.hist[i]));
+		++n;
+	}
+	return n;
+}
+
+/* replaces SNAP_FILE with snap, creating its directory if need be;
+ * a failed save only costs the next start its warm slots */
+static void
+snap_save(const struct snapshot *snap)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 4], *dir;
+	int fd, ok;
+
+	if (!snap_path(path, sizeof(path)))
+		return;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	dir = strrchr(tmp, '/');
+	if (dir && dir != tmp) {
+		*dir = '\0';
+		mkdir(tmp, 0700);
+		*dir = '/';
+	}
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		return;
+	ok = write(fd, snap, sizeof(*snap)) == (ssize_t)sizeof(*snap);
+	if (close(fd) == -1)
+		ok = 0;
+	if (!ok || rename(tmp, path) == -1)
+		unlink(tmp);
+}
+
+/* pauses the bar on SIGUSR1 and resumes it on SIGUSR2, e.g. from a
+ * screen locker: `pkill -USR1 -x barbar`. while paused nothing is
+ * written, polling producers sleep in wait_visible() and the others
+ * don't wake barbar; resuming redraws whatever they published */
+static void
+set_paused(struct shared_data *shm_data, uint32_t paused)
+{
+	pthread_mutex_lock(&shm_data->mutex);
+	__atomic_store_n(&shm_data->paused, paused, __ATOMIC_RELEASE);
+	if (!paused) {
+		++shm_data->version;
+		pthread_cond_broadcast(&shm_data->cond);
+	}
+	pthread_mutex_unlock(&shm_data->mutex);
+	if (!paused)
+		futex_wake(&shm_data->paused);
+}
+
+/* waits for SIGINT or SIGTERM, then wakes the main loop to exit;
+ * SIGUSR1 and SIGUSR2 pause and resume it on the way */
+static void *
+wait_signal(void *arg)
+{
+	struct shared_data *shm_data = arg;
+	sigset_t sigs;
+	int sig;
+
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGUSR1);
+	sigaddset(&sigs, SIGUSR2);
+	for (;;) {
+		if (sigwait(&sigs, &sig) != 0)
+			continue;
+		if (sig != SIGUSR1 && sig != SIGUSR2)
+			break;
+		set_paused(shm_data, sig == SIGUSR1);
+	}
+
+	pthread_mutex_lock(&shm_data->mutex);
 	term_sig = sig;
 	terminate = 1;
+	pthread_cond_broadcast(&shm_data->cond);
+	pthread_mutex_unlock(&shm_data->mutex);
+	return NULL;
 }
@@ -11,12 +11,27 @@
 
 static const char *mname = "music";
 static volatile sig_atomic_t terminate = 0;
+static volatile sig_atomic_t refresh = 0;
 static int term_sig = 0;
 
-static void  get_cmus(char *title, size_t, char *artist, size_t);
+/* player state as reported by cmus-remote -Q */
+enum cmus_state { CMUS_ABSENT, CMUS_STOPPED, CMUS_PAUSED, CMUS_PLAYING };
+
+static enum cmus_state get_cmus(char *title, size_t, char *artist, size_t,
+                                long *pos, long *dur);
+static void  copy_tag(char *dst, size_t len, char *src);
 static void  get_volume(char *vol, size_t);
+static void  handle_click(int button);
+static void  handle_refresh(int sig);
 static void  handle_signal(int sig);
 
+/*
+ * the poll interval follows the player:
+ *  - playing: sleep until just past the expected end of the track
+ *  - absent, stopped or paused: back off exponentially from MUSIC_S
+ * both are capped at MUSIC_MAX_S, and a click on the bar or SIGUSR1
+ * forces an immediate refresh
+ */
 int
 main(void)
 {
@@ -25,26 +40,76 @@ main(void)
         sigemptyset(&sa.sa_mask);
         sigaction(SIGINT,  &sa, NULL);
         sigaction(SIGTERM, &sa, NULL);
+        sa.sa_handler = handle_refresh;
+        sigaction(SIGUSR1, &sa, NULL);
+
+        enum cmus_state last_state = CMUS_ABSENT;
+        struct timespec backoff = { .tv_sec = MUSIC_S, .tv_nsec = MUSIC_NS };
+        char last[300] = "";
 
         while (!terminate) {
                 char title[128]  = "?";
                 char artist[128] = "?";
                 char vol[16]     = "?%";
+                long pos = -1, dur = -1;
+
+                /* spawn nothing while the bar is hidden, refresh
+                 * as soon as it is back */
+                if (wait_visible(mname) < 0)
+                        continue;
 
-                get_cmus(title, sizeof title, artist, sizeof artist);
+                refresh = 0;
+                enum cmus_state state = get_cmus(title, sizeof title,
+                                                 artist, sizeof artist,
+                                                 &pos, &dur);
                 get_volume(vol, sizeof vol);
 
+                /* only publish when the rendered line changes */
                 char buf[300];
-                snprintf(buf, sizeof buf, "%s - %s - %s%s", title, artist, vol, "%");
-                w2s(mname, buf);
+                snprintf(buf, sizeof buf, "%s - %s - %s", title, artist, vol);
+                if (strcmp(buf, last) != 0) {
+                        w2s2(mname, title, "%s", buf);
+                        /* others can have the volume without a probe */
+                        if (isdigit((unsigned char)vol[0]))
+                                kv_put_int(mname, "music.volume", atoi(vol));
+                        memcpy(last, buf, sizeof last);
+                }
 
-                /* sleep 2 seconds */
-                struct timespec ts = { .tv_sec = 2, .tv_nsec = 0 };
-                while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
-                        continue;
+                /* restart the backoff whenever the player changes state */
+                if (state != last_state) {
+                        backoff.tv_sec  = MUSIC_S;
+                        backoff.tv_nsec = MUSIC_NS;
+                        last_state = state;
+                }
+
+                struct timespec ts = backoff;
+                if (state == CMUS_PLAYING && dur > 0 && pos >= 0) {
+                        long left = dur - pos + 1;
+                        ts.tv_sec  = left < MUSIC_MAX_S ? left : MUSIC_MAX_S;
+                        ts.tv_nsec = 0;
+                } else if (backoff.tv_sec < MUSIC_MAX_S) {
+                        backoff.tv_sec *= 2;
+                        backoff.tv_nsec *= 2;
+                        if (backoff.tv_nsec >= 1000000000L) {
+                                ++backoff.tv_sec;
+                                backoff.tv_nsec -= 1000000000L;
+                        }
+                        if (backoff.tv_sec >= MUSIC_MAX_S) {
+                                backoff.tv_sec  = MUSIC_MAX_S;
+                                backoff.tv_nsec = 0;
+                        }
+                }
+
+                /* sleep, cut short by a click or a signal */
+                int button = mbox_wait(mname, &ts);
+                if (button > 0)
+                        handle_click(button);
         }
 
         w2s(mname, "%s", strsignal(term_sig));
+#ifdef BENCH
+        bench_report(mname, "exit", "spawns=%lu", bench_spawns);
+#endif
         return 0;
 }
 
@@ -58,35 +123,63 @@ ltrim(char *s)
         return s;
 }
 
-/* extract title / artist from cmus-remote -Q output */
+/* copy a tag value, cut at the start of a character if it doesn't fit */
 static void
-get_cmus(char *title, size_t tlen, char *artist, size_t alen)
+copy_tag(char *dst, size_t len, char *src)
+{
+        size_t n;
+
+        src = ltrim(src);
+        n = strcspn(src, "\r\n");
+        if (n >= len) {
+                n = len - 1;
+                while (n > 0 && ((unsigned char)src[n] & 0xc0) == 0x80)
+                        --n;
+        }
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+}
+
+/* extract state, title / artist and track timing from cmus-remote -Q */
+static enum cmus_state
+get_cmus(char *title, size_t tlen, char *artist, size_t alen,
+         long *pos, long *dur)
 {
+        enum cmus_state state = CMUS_ABSENT;
+        BENCH_SPAWN_BEGIN();
         FILE *fp = popen("cmus-remote -Q 2>/dev/null", "r");
         if (!fp)
-                return;
+                return state;
 
         char line[256];
         while (fgets(line, sizeof line, fp)) {
-                if (!strncmp(line, "tag title", 9)) {
-                        char *p = ltrim(line + 9);
-                        p[strcspn(p, "\r\n")] = '\0';
-                        strncpy(title, p, tlen - 1);
-                        title[tlen - 1] = '\0';
+                if (!strncmp(line, "status ", 7)) {
+                        if (!strncmp(line + 7, "playing", 7))
+                                state = CMUS_PLAYING;
+                        else if (!strncmp(line + 7, "paused", 6))
+                                state = CMUS_PAUSED;
+                        else
+                                state = CMUS_STOPPED;
+                } else if (!strncmp(line, "position ", 9)) {
+                        *pos = strtol(line + 9, NULL, 10);
+                } else if (!strncmp(line, "duration ", 9)) {
+                        *dur = strtol(line + 9, NULL, 10);
+                } else if (!strncmp(line, "tag title", 9)) {
+                        copy_tag(title, tlen, line + 9);
                 } else if (!strncmp(line, "tag artist", 10)) {
-                        char *p = ltrim(line + 10);
-                        p[strcspn(p, "\r\n")] = '\0';
-                        strncpy(artist, p, alen - 1);
-                        artist[alen - 1] = '\0';
+                        copy_tag(artist, alen, line + 10);
                 }
         }
         pclose(fp);
+        BENCH_SPAWN_END(mname, "cmus-remote -Q");
+        return state;
 }
 
 /* extract “###%” from first line of pactl volume output */
 static void
 get_volume(char *vol, size_t vlen)
 {
+        BENCH_SPAWN_BEGIN();
         FILE *fp = popen("pactl get-sink-volume @DEFAULT_SINK@ 2>/dev/null",
                          "r");
         if (!fp)
@@ -107,6 +200,42 @@ get_volume(char *vol, size_t vlen)
                 }
         }
         pclose(fp);
+        BENCH_SPAWN_END(mname, "pactl get-sink-volume");
+}
+
+/* left click: play/pause, right click: next track, scroll: volume */
+static void
+handle_click(int button)
+{
+        const char *cmd;
+
+        switch (button) {
+        case 1:
+                cmd = "cmus-remote -u 2>/dev/null";
+                break;
+        case 3:
+                cmd = "cmus-remote -n 2>/dev/null";
+                break;
+        case 4:
+                cmd = "pactl set-sink-volume @DEFAULT_SINK@ +5% 2>/dev/null";
+                break;
+        case 5:
+                cmd = "pactl set-sink-volume @DEFAULT_SINK@ -5% 2>/dev/null";
+                break;
+        default:
+                return;
+        }
+
+        BENCH_SPAWN_BEGIN();
+        system(cmd);
+        BENCH_SPAWN_END(mname, cmd);
+}
+
+static void
+handle_refresh(int sig)
+{
+	(void)sig;
+	refresh = 1;
 }
 
 static void  
@@ -0,0 +1,454 @@
+/*
+ * power updates barbar with the ac state, battery charge and backlight
+ * level, e.g. "ac 87% bl 60%", without polling: it listens for kernel
+ * uevents on a netlink socket and only looks again when a power_supply
+ * or backlight device reports a change
+
+ * power_supply events carry the new values, which are used as they
+ * are; other events re-read the attributes, from files opened once.
+ * every POWER_S seconds, and on a click, everything is re-read in
+ * case an event was lost
+
+ *   power              listens to the kernel
+ *   power -r file      replays recorded events instead, then exits;
+ *                      "udevadm monitor --kernel --property" output,
+ *                      records of KEY=VALUE lines split by blank lines
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "util.h"
+
+static const char            mname[]   = "power";
+static const char            psu_dir[] = "/sys/class/power_supply";
+static const char            bl_dir[]  = "/sys/class/backlight";
+static volatile sig_atomic_t terminate = 0;
+static volatile sig_atomic_t term_sig  = 0;
+
+/* what is shown, -1 where there is no such device */
+typedef struct {
+	int  ac;        /* online */
+	int  capacity;  /* battery percent */
+	int  charging;
+	int  bl;        /* backlight percent */
+} Power;
+
+/* the supplies shown and their attribute files, kept open */
+static char ac_name[NAME_MAX + 1]  = "";
+static char bat_name[NAME_MAX + 1] = "";
+static int  ac_fd     = -1;
+static int  cap_fd    = -1;
+static int  status_fd = -1;
+static int  bl_fd     = -1;
+static int  bl_max    = 0;
+
+static void handle_signal(int sig);
+static void handle_uevent(Power *pw, const char *msg, size_t len);
+static void open_devices(void);
+static int  ours(const char *name, const char *type, const char *scope,
+                 int bat);
+static void publish(const Power *pw);
+static int  read_int(int fd);
+static int  read_str(int fd, char *buf, size_t len);
+static void reread(Power *pw, int psu, int bl);
+static int  replay(const char *path, Power *pw);
+static int  uevent_socket(void);
+static void use_supply(const char *name, int bat);
+
+int
+main(int argc, char *argv[])
+{
+	char             buf[8192];
+	struct sockaddr_nl sender;
+	struct iovec     iov = { buf, sizeof(buf) - 1 };
+	struct msghdr    msg = { .msg_name = &sender,
+	                         .msg_namelen = sizeof(sender),
+	                         .msg_iov = &iov, .msg_iovlen = 1 };
+	struct sigaction sa;
+	struct timespec  timeout;
+	struct pollfd    pfd[2];
+	sigset_t         sigs, none;
+	uint64_t         clicks;
+	ssize_t          len;
+	Power            pw = { -1, -1, 0, -1 };
+
+	sa.sa_handler = handle_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* a replay takes signals as they come */
+	if (argc == 3 && !strcmp(argv[1], "-r"))
+		return replay(argv[2], &pw);
+	if (argc != 1) {
+		fprintf(stderr, "usage: %s [-r file]\n", argv[0]);
+		return 1;
+	}
+
+	/* listening, signals are only taken while waiting */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigprocmask(SIG_BLOCK, &sigs, NULL);
+	sigemptyset(&none);
+
+	/* subscribe before reading, so no change falls in between */
+	pfd[0].fd = uevent_socket();
+	if (pfd[0].fd < 0)
+		log_err("power: netlink uevent socket");
+	pfd[0].events = POLLIN;
+	pfd[1].fd = mbox_fd(mname);
+	pfd[1].events = POLLIN;
+
+	open_devices();
+	reread(&pw, 1, 1);
+	publish(&pw);
+
+	while (!terminate) {
+		timeout.tv_sec  = POWER_S;
+		timeout.tv_nsec = 0;
+
+		switch (clk_ppoll(pfd, 2, &timeout, &none)) {
+		case -1:
+			if (errno == EINTR)
+				continue;
+			log_err("power: ppoll: %s", strerror(errno));
+			break;
+		case 0:
+			/* the safety re-check */
+			reread(&pw, 1, 1);
+			break;
+		default:
+			if (pfd[1].revents) {
+				read(pfd[1].fd, &clicks, sizeof clicks);
+				while (mbox_take(mname))
+					;
+				reread(&pw, 1, 1);
+			}
+			if (!pfd[0].revents)
+				break;
+			while ((len = recvmsg(pfd[0].fd, &msg, MSG_DONTWAIT)) > 0) {
+				/* only the kernel may tell us about devices */
+				if (msg.msg_namelen == sizeof(sender) &&
+				    sender.nl_pid == 0)
+					handle_uevent(&pw, buf, len);
+				msg.msg_namelen = sizeof(sender);
+			}
+			/* ENOBUFS: events were dropped, look at everything */
+			if (len < 0 && errno == ENOBUFS)
+				reread(&pw, 1, 1);
+			break;
+		}
+		publish(&pw);
+	}
+
+	w2s(mname, "%s", strsignal(term_sig));
+	return 0;
+}
+
+static void
+handle_signal(int sig)
+{
+	term_sig  = sig;
+	terminate = 1;
+}
+
+/* msg is "action@devpath" followed by KEY=VALUE strings, all '\0'
+ * terminated; values the event carries are taken as they are, but
+ * only from the supplies shown, not from e.g. a mouse's battery */
+static void
+handle_uevent(Power *pw, const char *msg, size_t len)
+{
+	const char *p, *end = msg + len, *v, *name = NULL, *dev = NULL;
+	const char *type = "", *scope = "";
+	int psu = 0, bl = 0, ac, bat, known = 0;
+
+	for (p = msg; p < end; p += strlen(p) + 1) {
+		if (!strncmp(p, "SUBSYSTEM=", 10)) {
+			psu = !strcmp(p + 10, "power_supply");
+			bl  = !strcmp(p + 10, "backlight");
+		} else if (!strncmp(p, "DEVPATH=", 8)) {
+			dev = strrchr(p, '/');
+			dev = dev ? dev + 1 : p + 8;
+		} else if (!strncmp(p, "POWER_SUPPLY_NAME=", 18)) {
+			name = p + 18;
+		} else if (!strncmp(p, "POWER_SUPPLY_TYPE=", 18)) {
+			type = p + 18;
+		} else if (!strncmp(p, "POWER_SUPPLY_SCOPE=", 19)) {
+			scope = p + 19;
+		}
+	}
+	if (bl) {
+		reread(pw, 0, 1);
+		return;
+	}
+	if (!psu)
+		return;
+
+	if (!name)
+		name = dev;
+	ac  = ours(name, type, scope, 0);
+	bat = !ac && ours(name, type, scope, 1);
+	if (!ac && !bat)
+		return;
+
+	for (p = msg; p < end; p += strlen(p) + 1) {
+		if (strncmp(p, "POWER_SUPPLY_", 13))
+			continue;
+		p += 13;
+		if (!(v = strchr(p, '=')))
+			continue;
+		++v;
+		if (ac && !strncmp(p, "ONLINE=", 7)) {
+			pw->ac = atoi(v);
+			known = 1;
+		} else if (bat && !strncmp(p, "CAPACITY=", 9)) {
+			pw->capacity = atoi(v);
+			known = 1;
+		} else if (bat && !strncmp(p, "STATUS=", 7)) {
+			pw->charging = !strcmp(v, "Charging");
+			known = 1;
+		}
+	}
+	if (!known)
+		reread(pw, 1, 0);
+}
+
+/* the first battery, the first mains supply (or else usb) and the first
+ * backlight; peripherals, whose scope is "Device", are left out */
+static void
+open_devices(void)
+{
+	char path[PATH_MAX], type[16], scope[16], usb[sizeof(ac_name)] = "";
+	struct dirent *de;
+	DIR *dir;
+	int fd;
+
+	if ((dir = opendir(psu_dir))) {
+		while ((de = readdir(dir))) {
+			if (de->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "%s/%s/type",
+			         psu_dir, de->d_name);
+			if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+				continue;
+			read_str(fd, type, sizeof(type));
+			close(fd);
+			snprintf(path, sizeof(path), "%s/%s/scope",
+			         psu_dir, de->d_name);
+			fd = open(path, O_RDONLY | O_CLOEXEC);
+			read_str(fd, scope, sizeof(scope));
+			if (fd >= 0)
+				close(fd);
+			if (!strncmp(scope, "Device", 6))
+				continue;
+
+			if (!strncmp(type, "Battery", 7) && cap_fd < 0)
+				use_supply(de->d_name, 1);
+			else if (!strncmp(type, "Mains", 5) && ac_fd < 0)
+				use_supply(de->d_name, 0);
+			else if (!strncmp(type, "USB", 3) && !usb[0])
+				snprintf(usb, sizeof(usb), "%s", de->d_name);
+		}
+		closedir(dir);
+	}
+	if (ac_fd < 0 && usb[0])
+		use_supply(usb, 0);
+
+	if ((dir = opendir(bl_dir))) {
+		while (bl_fd < 0 && (de = readdir(dir))) {
+			if (de->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "%s/%s/max_brightness",
+			         bl_dir, de->d_name);
+			if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+				continue;
+			bl_max = read_int(fd);
+			close(fd);
+			snprintf(path, sizeof(path), "%s/%s/brightness",
+			         bl_dir, de->d_name);
+			if (bl_max > 0)
+				bl_fd = open(path, O_RDONLY | O_CLOEXEC);
+		}
+		closedir(dir);
+	}
+}
+
+/* whether name is the supply shown as ac (or the battery); without one
+ * yet, as in a replay, the first mains (or battery) supply not of some
+ * peripheral is taken */
+static int
+ours(const char *name, const char *type, const char *scope, int bat)
+{
+	const char *chosen = bat ? bat_name : ac_name;
+
+	if (!name)
+		return 0;
+	if (chosen[0])
+		return !strcmp(chosen, name);
+	if (strcmp(type, bat ? "Battery" : "Mains") || !strcmp(scope, "Device"))
+		return 0;
+	use_supply(name, bat);
+	return 1;
+}
+
+/* only publish when the rendered line changes */
+static void
+publish(const Power *pw)
+{
+	static char last[MSG_LEN] = "";
+	char out[MSG_LEN], *p = out, *end = out + sizeof(out);
+
+	*p = '\0';
+	if (pw->ac >= 0)
+		p += snprintf(p, end - p, "%s", pw->ac ? "ac" : "bat");
+	if (pw->capacity >= 0 && p < end)
+		p += snprintf(p, end - p, "%s%d%%%s", p == out ? "" : " ",
+		              pw->capacity, pw->charging ? "+" : "");
+	if (pw->bl >= 0 && p < end)
+		snprintf(p, end - p, "%sbl %d%%", p == out ? "" : " ", pw->bl);
+
+	if (strcmp(out, last) != 0) {
+		w2s(mname, "%s", out);
+		memcpy(last, out, sizeof(last));
+	}
+}
+
+/* a sysfs attribute holding a number, -1 if it can't be read */
+static int
+read_int(int fd)
+{
+	char buf[32];
+
+	if (!read_str(fd, buf, sizeof(buf)))
+		return -1;
+	return atoi(buf);
+}
+
+/* a sysfs attribute from the start, terminated; 0 if it can't be read */
+static int
+read_str(int fd, char *buf, size_t len)
+{
+	ssize_t n = -1;
+
+	while (fd >= 0 && (n = pread(fd, buf, len - 1, 0)) < 0 && errno == EINTR)
+		;
+	buf[n > 0 ? n : 0] = '\0';
+	return n > 0;
+}
+
+/* reads the power supply and/or backlight attributes */
+static void
+reread(Power *pw, int psu, int bl)
+{
+	char status[16];
+	int n;
+
+	if (psu) {
+		pw->ac       = read_int(ac_fd);
+		pw->capacity = read_int(cap_fd);
+		read_str(status_fd, status, sizeof(status));
+		pw->charging = !strncmp(status, "Charging", 8);
+	}
+	if (bl && bl_fd >= 0) {
+		n = read_int(bl_fd);
+		pw->bl = n < 0 ? -1 : 100 * n / bl_max;
+	}
+}
+
+/* feeds recorded events through handle_uevent(), publishing after each */
+static int
+replay(const char *path, Power *pw)
+{
+	char   *line = NULL, msg[8192];
+	size_t  cap = 0, len = 0, n;
+	FILE   *fp;
+
+	fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!fp) {
+		perror(path);
+		return 1;
+	}
+	for (;;) {
+		int eof = getline(&line, &cap, fp) == -1;
+
+		if (!eof) {
+			line[strcspn(line, "\n")] = '\0';
+			n = strlen(line);
+			/* KEY=VALUE lines make up the event */
+			if (n && strchr(line, '=') && len + n + 1 <= sizeof(msg)) {
+				memcpy(msg + len, line, n + 1);
+				len += n + 1;
+				continue;
+			}
+			if (n)
+				continue;
+		}
+		if (len) {
+			handle_uevent(pw, msg, len);
+			publish(pw);
+			len = 0;
+		}
+		if (eof || terminate)
+			break;
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	return 0;
+}
+
+/* a socket on the kernel's uevent multicast group */
+static int
+uevent_socket(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,
+	};
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+	            NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -1;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* shows the supply called name as ac (or as the battery), opening its
+ * attribute files */
+static void
+use_supply(const char *name, int bat)
+{
+	char path[PATH_MAX];
+
+	if (bat) {
+		snprintf(bat_name, sizeof(bat_name), "%s", name);
+		snprintf(path, sizeof(path), "%s/%s/capacity", psu_dir, name);
+		cap_fd = open(path, O_RDONLY | O_CLOEXEC);
+		snprintf(path, sizeof(path), "%s/%s/status", psu_dir, name);
+		status_fd = open(path, O_RDONLY | O_CLOEXEC);
+	} else {
+		snprintf(ac_name, sizeof(ac_name), "%s", name);
+		snprintf(path, sizeof(path), "%s/%s/online", psu_dir, name);
+		ac_fd = open(path, O_RDONLY | O_CLOEXEC);
+	}
+}
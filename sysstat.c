@@ -0,0 +1,311 @@
+/*
+ * sysstat updates barbar with cpu and memory use, the battery and
+ * network throughput, e.g. "cpu 12% mem 43% bat 87%+ ↓1.2M ↑30K"
+
+ * every SYSSTAT_S seconds it re-reads its sources, which are opened
+ * once and read with pread() into buffers that only grow until the
+ * files fit: no popen, no stdio and no allocation per tick. cpu and
+ * network are deltas between two ticks, and barbar is only written to
+ * when the text changes
+
+ * a click on the slot refreshes it at once, and while barbar is
+ * paused it stops sampling
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+static const char            mname[]   = "sysstat";
+static const char            psu_dir[] = "/sys/class/power_supply";
+static volatile sig_atomic_t terminate = 0;
+static volatile sig_atomic_t term_sig  = 0;
+
+/* counters of the last tick, for the deltas */
+typedef struct {
+	unsigned long long busy, total;  /* cpu jiffies */
+	unsigned long long rx, tx;       /* bytes over all interfaces but lo */
+	struct timespec    at;
+} Sample;
+
+static const char        *field(const char *s, const char *key);
+static void               find_battery(int *cap_fd, int *status_fd);
+static void               fmt_rate(char *buf, size_t len, double bytes);
+static void               handle_signal(int sig);
+static unsigned long long num(const char **s);
+static int                open_ro(const char *path);
+static ssize_t            slurp(int fd, char *buf, size_t len);
+static ssize_t            slurp_all(int fd, char **buf, size_t *len);
+
+int
+main(void)
+{
+	/* only the first lines of /proc/stat and /proc/meminfo are used,
+	 * /proc/net/dev has a line per interface */
+	char stat_buf[256], mem_buf[256], *net_buf = NULL, small[32];
+	char out[2 * MSG_LEN], last[2 * MSG_LEN] = "", shrt[MSG_LEN];
+	char rx_s[16], tx_s[16], bat[16];
+	int stat_fd, mem_fd, net_fd, cap_fd, status_fd, cpu, mem, have_last = 0;
+	unsigned long long jiffies[8], total_kb, avail_kb;
+	struct sigaction sa;
+	struct timespec ts;
+	Sample cur, prev = {0};
+	size_t net_len = 4096;
+	const char *p;
+	double secs;
+
+	sa.sa_handler = handle_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	stat_fd = open_ro("/proc/stat");
+	mem_fd  = open_ro("/proc/meminfo");
+	net_fd  = open_ro("/proc/net/dev");
+	if (stat_fd < 0 || mem_fd < 0)
+		log_err("sysstat: /proc is not readable");
+	find_battery(&cap_fd, &status_fd);
+
+	while (!terminate) {
+		/* nothing is sampled while the bar is hidden,
+		 * and the deltas start over afterwards */
+		if (wait_visible(mname) != 0) {
+			have_last = 0;
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &cur.at);
+
+		/* "cpu  user nice system idle iowait irq softirq steal ..." */
+		cpu = -1;
+		if (slurp(stat_fd, stat_buf, sizeof(stat_buf)) > 0 &&
+		    (p = field(stat_buf, "cpu "))) {
+			cur.total = 0;
+			for (int i = 0; i < 8; ++i)
+				cur.total += jiffies[i] = num(&p);
+			cur.busy = cur.total - jiffies[3] - jiffies[4];
+			if (have_last && cur.total > prev.total)
+				cpu = (int)(100 * (cur.busy - prev.busy) /
+				            (cur.total - prev.total));
+		}
+
+		mem = -1;
+		if (slurp(mem_fd, mem_buf, sizeof(mem_buf)) > 0 &&
+		    (p = field(mem_buf, "MemTotal:")) && (total_kb = num(&p)) &&
+		    (p = field(mem_buf, "MemAvailable:"))) {
+			avail_kb = num(&p);
+			mem = (int)(100 - 100 * avail_kb / total_kb);
+		}
+
+		/* "  eth0: rx_bytes 7 more fields tx_bytes ..." */
+		cur.rx = cur.tx = 0;
+		if (net_fd >= 0 && slurp_all(net_fd, &net_buf, &net_len) > 0) {
+			for (p = strchr(net_buf, '\n'); p && (p = strchr(p + 1, '\n')); ) {
+				const char *colon = strchr(p, ':');
+				const char *name  = p + 1 + strspn(p + 1, " ");
+
+				if (!colon)
+					break;
+				if (strncmp(name, "lo:", 3)) {
+					const char *q = colon + 1;
+					cur.rx += num(&q);
+					for (int i = 0; i < 7; ++i)
+						num(&q);
+					cur.tx += num(&q);
+				}
+			}
+		}
+
+		/* "87" and "Charging", "Discharging", "Full" ... */
+		bat[0] = '\0';
+		if (cap_fd >= 0 && slurp(cap_fd, small, sizeof(small)) > 0) {
+			p = small;
+			snprintf(bat, sizeof(bat), " bat %llu%%%s", num(&p),
+			         status_fd >= 0 &&
+			         slurp(status_fd, small, sizeof(small)) > 0 &&
+			         small[0] == 'C' ? "+" : "");
+		}
+
+		rx_s[0] = tx_s[0] = '\0';
+		if (have_last) {
+			secs = (cur.at.tv_sec - prev.at.tv_sec) +
+			       (cur.at.tv_nsec - prev.at.tv_nsec) / 1e9;
+			if (net_fd >= 0 && secs > 0 &&
+			    cur.rx >= prev.rx && cur.tx >= prev.tx) {
+				fmt_rate(rx_s, sizeof(rx_s),
+				         (cur.rx - prev.rx) / secs);
+				fmt_rate(tx_s, sizeof(tx_s),
+				         (cur.tx - prev.tx) / secs);
+			}
+		}
+
+		snprintf(out, sizeof(out), "cpu %d%% mem %d%%%s%s%s%s%s",
+		         cpu < 0 ? 0 : cpu, mem < 0 ? 0 : mem, bat,
+		         rx_s[0] ? " ↓" : "", rx_s, tx_s[0] ? " ↑" : "", tx_s);
+
+		/* only publish when the rendered line changes, and not
+		 * before there are deltas */
+		if (have_last && strcmp(out, last) != 0) {
+			snprintf(shrt, sizeof(shrt), "%d%% %d%%",
+			         cpu < 0 ? 0 : cpu, mem < 0 ? 0 : mem);
+			w2s2(mname, shrt, "%s", out);
+			memcpy(last, out, sizeof(last));
+		}
+
+		/* sleep, cut short by a click or a signal;
+		 * the first deltas are taken over a short nap */
+		ts.tv_sec  = have_last ? SYSSTAT_S : 0;
+		ts.tv_nsec = have_last ? 0 : 250000000L;
+		prev = cur;
+		have_last = 1;
+		mbox_wait(mname, &ts);
+	}
+
+	free(net_buf);
+	w2s(mname, "%s", strsignal(term_sig));
+	return 0;
+}
+
+/* the first battery in psu_dir, -1 for each file there is none of */
+static void
+find_battery(int *cap_fd, int *status_fd)
+{
+	char path[PATH_MAX], type[16];
+	struct dirent *de;
+	DIR *dir;
+	int fd;
+
+	*cap_fd = *status_fd = -1;
+	dir = opendir(psu_dir);
+	if (!dir)
+		return;
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s/type", psu_dir, de->d_name);
+		fd = open_ro(path);
+		if (fd < 0)
+			continue;
+		if (slurp(fd, type, sizeof(type)) > 0 &&
+		    !strncmp(type, "Battery", 7)) {
+			snprintf(path, sizeof(path), "%s/%s/capacity",
+			         psu_dir, de->d_name);
+			*cap_fd = open_ro(path);
+			snprintf(path, sizeof(path), "%s/%s/status",
+			         psu_dir, de->d_name);
+			if (*cap_fd >= 0)
+				*status_fd = open_ro(path);
+		}
+		close(fd);
+		if (*cap_fd >= 0)
+			break;
+	}
+	closedir(dir);
+}
+
+/* the text after key, when key starts a line of s */
+static const char *
+field(const char *s, const char *key)
+{
+	size_t len = strlen(key);
+
+	for (const char *p = s; p; p = strchr(p, '\n')) {
+		if (*p == '\n')
+			++p;
+		if (!strncmp(p, key, len))
+			return p + len;
+	}
+	return NULL;
+}
+
+/* 930 -> "930B", 1234567 -> "1.2M" */
+static void
+fmt_rate(char *buf, size_t len, double bytes)
+{
+	static const char units[] = "BKMG";
+	int u = 0;
+
+	while (bytes >= 1000 && u < 3) {
+		bytes /= 1024;
+		++u;
+	}
+	if (u == 0 || bytes >= 10)
+		snprintf(buf, len, "%.0f%c", bytes, units[u]);
+	else
+		snprintf(buf, len, "%.1f%c", bytes, units[u]);
+}
+
+static void
+handle_signal(int sig)
+{
+	term_sig  = sig;
+	terminate = 1;
+}
+
+/* parses the next decimal number at *s, skipping what comes before it */
+static unsigned long long
+num(const char **s)
+{
+	const char *p = *s;
+	unsigned long long n = 0;
+
+	while (*p && (*p < '0' || *p > '9') && *p != '\n')
+		++p;
+	while (*p >= '0' && *p <= '9')
+		n = n * 10 + (*p++ - '0');
+	*s = p;
+	return n;
+}
+
+static int
+open_ro(const char *path)
+{
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/* reads the whole of a /proc or /sys file from the start, as far as it
+ * fits in buf, and terminates it */
+static ssize_t
+slurp(int fd, char *buf, size_t len)
+{
+	ssize_t n;
+
+	while ((n = pread(fd, buf, len - 1, 0)) < 0 && errno == EINTR)
+		;
+	buf[n > 0 ? n : 0] = '\0';
+	return n;
+}
+
+/* slurp() into a buffer that grows until the whole file fits, starting
+ * at *len bytes; returns -1 if it can't grow */
+static ssize_t
+slurp_all(int fd, char **buf, size_t *len)
+{
+	ssize_t n;
+	char *p;
+
+	for (;;) {
+		if (!*buf && !(*buf = malloc(*len)))
+			return -1;
+		/* a full buffer may have cut the file short */
+		n = slurp(fd, *buf, *len);
+		if (n < (ssize_t)*len - 1)
+			return n;
+		if (!(p = realloc(*buf, *len * 2)))
+			return n;
+		*buf = p;
+		*len *= 2;
+	}
+}
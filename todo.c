@@ -0,0 +1,103 @@
+/*
+ * todo updates barbar with the number of open tasks in a todo.txt
+ * file: every non-blank line not marked done ("x ") is one. the file
+ * is followed by the watch engine, so adding a task only costs
+ * parsing that line, and ticking one off a reparse
+ */
+
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "watch.h"
+
+static const char            mname[]  = "todo";
+static const char            tf[]     = "/todo.txt";
+static const char            suffix[] = "项待办";
+static const char            done[]   = "没有待办";
+static volatile sig_atomic_t terminate = 0;
+static volatile sig_atomic_t term_sig  = 0;
+
+static void handle_signal(int sig);
+static void line(const char *s, size_t len, void *arg);
+static void reset(void *arg);
+static void show(const char *module, void *arg);
+
+int
+main(void)
+{
+	char             path[PATH_MAX];
+	char            *home;
+	int              open_tasks = 0;
+	struct sigaction sa;
+	sigset_t         sigs;
+	struct watch     w = {
+		.path  = path,
+		.reset = reset,
+		.line  = line,
+		.show  = show,
+		.arg   = &open_tasks,
+	};
+
+	/* signals are only taken while the engine waits */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigprocmask(SIG_BLOCK, &sigs, NULL);
+
+	sa.sa_handler = handle_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	home = getenv("HOME");
+	if (!home)
+		log_err("home envp");
+	snprintf(path, sizeof(path), "%s%s", home, tf);
+
+	if (watch_run(mname, &w, 1, &terminate) < 0)
+		log_err("todo: watching %s failed", path);
+
+	w2s(mname, "%s", strsignal(term_sig));
+	return 0;
+}
+
+static void
+handle_signal(int sig)
+{
+	term_sig  = sig;
+	terminate = 1;
+}
+
+static void
+line(const char *s, size_t len, void *arg)
+{
+	int *open_tasks = arg;
+
+	if (strspn(s, " \t\r") >= len)
+		return;
+	if (len >= 2 && s[0] == 'x' && s[1] == ' ')
+		return;
+	++*open_tasks;
+}
+
+static void
+reset(void *arg)
+{
+	*(int *)arg = 0;
+}
+
+static void
+show(const char *module, void *arg)
+{
+	int open_tasks = *(int *)arg;
+
+	if (open_tasks < 1)
+		w2s(module, "%s", done);
+	else
+		w2s(module, "%d%s", open_tasks, suffix);
+}
@@ -1,17 +1,30 @@
 #define _GNU_SOURCE
 
+#include <errno.h>
+#include <limits.h>
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sched.h>
 #include <syslog.h>
+#include <unistd.h>
+#include <wchar.h>
 
 #include "config.h"
 #include "util.h"
 
+_Static_assert(sizeof(BUDGETS) / sizeof(BUDGETS[0]) == NUM_MODULES,
+               "BUDGETS needs one entry per module");
+
 /* writes formatted string to syslog and exits */
 void
 log_err(const char *fmt, ...)
@@ -23,46 +36,1355 @@ log_err(const char *fmt, ...)
 	exit(1);
 }
 
-/* locks mutex, writes to shared memory, unlocks mutex */
+#ifdef VCLOCK
+/* virtual time, and how much faster than real time it runs (0 = instant) */
+static struct timespec vnow;
+static double          vspeed = 0;
+static time_t          vend   = 0; /* SIGINT at this virtual time, 0 = never */
+static int             vinit  = 0;
+
+static void
+vclock_init(void)
+{
+	const char *start = getenv("BARBAR_VCLOCK_START");
+	const char *speed = getenv("BARBAR_VCLOCK_SPEED");
+	const char *end   = getenv("BARBAR_VCLOCK_END");
+
+	if (vinit)
+		return;
+	vinit = 1;
+	clock_gettime(CLOCK_REALTIME, &vnow);
+	if (start && *start) {
+		vnow.tv_sec  = strtoll(start, NULL, 10);
+		vnow.tv_nsec = 0;
+	}
+	if (speed && *speed)
+		vspeed = strtod(speed, NULL);
+	if (end && *end)
+		vend = strtoll(end, NULL, 10);
+}
+
+static void
+vclock_advance(const struct timespec *d)
+{
+	vnow.tv_sec  += d->tv_sec;
+	vnow.tv_nsec += d->tv_nsec;
+	if (vnow.tv_nsec >= 1000000000L) {
+		++vnow.tv_sec;
+		vnow.tv_nsec -= 1000000000L;
+	}
+	/* a run covers a fixed period, then stops as on ctrl-c */
+	if (vend && vnow.tv_sec >= vend) {
+		vend = 0;
+		raise(SIGINT);
+	}
+}
+
+/* the real wait standing for a virtual one */
+static struct timespec
+vclock_scale(const struct timespec *d)
+{
+	struct timespec r = { 0, 0 };
+	double secs;
+
+	if (vspeed > 0) {
+		secs = (d->tv_sec + d->tv_nsec / 1e9) / vspeed;
+		r.tv_sec  = (time_t)secs;
+		r.tv_nsec = (long)((secs - r.tv_sec) * 1e9);
+	}
+	return r;
+}
+#endif
+
+time_t
+clk_now(void)
+{
+#ifdef VCLOCK
+	vclock_init();
+	return vnow.tv_sec;
+#else
+	return time(NULL);
+#endif
+}
+
+unsigned int
+clk_sleep(unsigned int secs)
+{
+#ifdef VCLOCK
+	struct timespec d = { secs, 0 };
+	return clk_nanosleep(&d, NULL) == 0 ? 0 : secs;
+#else
+	return sleep(secs);
+#endif
+}
+
+int
+clk_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+#ifdef VCLOCK
+	struct timespec r;
+
+	vclock_init();
+	r = vclock_scale(req);
+	if (r.tv_sec || r.tv_nsec)
+		nanosleep(&r, NULL);
+	vclock_advance(req);
+	if (rem)
+		rem->tv_sec = rem->tv_nsec = 0;
+	return 0;
+#else
+	return nanosleep(req, rem);
+#endif
+}
+
+int
+clk_ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *timeout,
+          const sigset_t *mask)
+{
+#ifdef VCLOCK
+	struct timespec r;
+	int ret;
+
+	vclock_init();
+	if (!timeout)
+		return ppoll(fds, nfds, NULL, mask);
+
+	/* events that are already pending win over the timeout,
+	 * otherwise the whole timeout passes */
+	r = vclock_scale(timeout);
+	ret = ppoll(fds, nfds, &r, mask);
+	if (ret == 0)
+		vclock_advance(timeout);
+	return ret;
+#else
+	return ppoll(fds, nfds, timeout, mask);
+#endif
+}
+
+/* trace ring of this process, trace_on is 0 until first use */
+static struct trace_ring *trace_ring = NULL;
+static int                trace_on   = 0;
+
+/* maps BARBAR_TRACE/<prog>.<pid>.ring, or disables tracing for good */
+static void
+trace_open(void)
+{
+	char path[PATH_MAX];
+	const char *dir = getenv("BARBAR_TRACE");
+	struct trace_ring *r;
+	int fd;
+
+	trace_on = -1;
+	if (!dir || !*dir)
+		return;
+
+	snprintf(path, sizeof(path), "%s/%s.%d.ring",
+	         dir, program_invocation_short_name, (int)getpid());
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		return;
+	if (ftruncate(fd, sizeof(struct trace_ring)) == -1) {
+		close(fd);
+		return;
+	}
+	r = mmap(NULL, sizeof(struct trace_ring), PROT_READ | PROT_WRITE,
+	         MAP_SHARED, fd, 0);
+	close(fd);
+	if (r == MAP_FAILED)
+		return;
+
+	r->pid = getpid();
+	snprintf(r->name, sizeof(r->name), "%s", program_invocation_short_name);
+	r->magic = TRACE_MAGIC;
+	trace_ring = r;
+	trace_on = 1;
+}
+
+/* appends one event to the trace ring, a no-op unless BARBAR_TRACE is set */
 void
-w2s(const char *module_name, const char *fmt, ...)
+trace_ev(enum trace_kind kind, unsigned long arg)
 {
-	/* initialize once, keep value for future calls ("static") */
-	static struct shared_data *shm_data = NULL;
-	static int idx = -1;
-
-	/* on first write, initialize variables */
-	if (!shm_data) {
-		int shm_fd = shm_open(SHM_NAME, O_RDWR, 0600);
-		if (shm_fd == -1)
-			log_err("%s: shm_open failed", module_name);
-		shm_data = mmap(NULL, sizeof(struct shared_data),
-		                PROT_READ | PROT_WRITE, 
-				MAP_SHARED, shm_fd, 0);
-		if (shm_data == MAP_FAILED)
-			log_err("%s: mmap failed", module_name);
-
-		/* find the index based on module name */
-		for (int i = 0; i < (int)NUM_MODULES; ++i) {
-			if (strcmp(MODULES[i], module_name) == 0) {
-				idx = i;
-				break;
+	struct trace_event *ev;
+	struct timespec ts;
+	uint64_t i;
+	int saved = errno;
+
+	if (!trace_on)
+		trace_open();
+	if (trace_on < 0) {
+		errno = saved;
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	i  = __atomic_fetch_add(&trace_ring->head, 1, __ATOMIC_RELAXED);
+	ev = &trace_ring->ev[i % TRACE_LEN];
+	ev->ns   = (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+	ev->kind = kind;
+	ev->arg  = (uint32_t)arg;
+	errno = saved;
+}
+
+#ifdef BENCH
+unsigned long bench_w2s = 0;
+
+/* prints one machine-readable measurement line to stderr,
+ * always followed by the w2s() count and peak rss so far */
+void
+bench_report(const char *module, const char *event, const char *fmt, ...)
+{
+	struct rusage ru;
+	va_list args;
+
+	getrusage(RUSAGE_SELF, &ru);
+	fprintf(stderr, "%s %s ", module, event);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, " w2s=%lu maxrss_kb=%ld\n", bench_w2s, ru.ru_maxrss);
+}
+
+unsigned long          bench_spawns = 0;
+static struct timespec bench_spawn_t0;
+
+void
+bench_spawn_begin(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &bench_spawn_t0);
+}
+
+/* reports the spawn of cmd (its first word) since bench_spawn_begin():
+ * its wall time, and the cpu time and peak rss of all children reaped
+ * so far */
+void
+bench_spawn_end(const char *module, const char *cmd)
+{
+	struct timespec t1;
+	struct rusage ru;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	getrusage(RUSAGE_CHILDREN, &ru);
+	++bench_spawns;
+	bench_report(module, "spawn",
+	             "cmd=%.*s ns=%lld spawns=%lu child_cpu_us=%lld "
+	             "child_maxrss_kb=%ld",
+	             (int)strcspn(cmd, " "), cmd,
+	             (long long)(t1.tv_sec - bench_spawn_t0.tv_sec) *
+	             1000000000LL + (t1.tv_nsec - bench_spawn_t0.tv_nsec),
+	             bench_spawns,
+	             (long long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) *
+	             1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec,
+	             ru.ru_maxrss);
+}
+#endif
+
+/*
+ * producer side of the segment: the mapping, the generation it was
+ * made in, and the latest value of this module's slot, which is kept
+ * while barbar is absent and republished whenever a new barbar shows up
+ */
+static pthread_mutex_t     conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct shared_data *conn      = NULL;
+static uint32_t            conn_gen  = 0;
+static int                 conn_idx  = -1;
+static struct slot         latest;
+static uint32_t            mbox_seen = 0; /* events of ours taken so far */
+static int                 mbox_efd  = -1;
+static struct kv           kv_own[KV_LEN]; /* values we share, latest first */
+static int                 kv_nown   = 0;
+
+/* threads blocked on a futex in the segment hold a reference to its
+ * mapping, see pin(): a mapping barbar retires while any are left is
+ * kept here, and unmapped by the last of them to let go */
+#define RETIRED_LEN 8
+static int                 conn_refs = 0;
+static struct {
+	struct shared_data *d;
+	int                 refs;
+} retired[RETIRED_LEN];
+
+long
+futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+long
+futex_wake(uint32_t *addr)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* drops the mapping of a retired segment, or leaves that to the
+ * threads still waiting on it. called with conn_lock held */
+static void
+unmap_conn(void)
+{
+	int i;
+
+	if (conn_refs == 0) {
+		munmap(conn, sizeof(struct shared_data));
+		return;
+	}
+	for (i = 0; i < RETIRED_LEN && retired[i].d; ++i)
+		;
+	/* with every entry in use the mapping is just never unmapped */
+	if (i < RETIRED_LEN) {
+		retired[i].d    = conn;
+		retired[i].refs = conn_refs;
+	}
+	conn_refs = 0;
+}
+
+/* takes a reference to d, the current mapping, so that it stays mapped
+ * while the caller waits on it without conn_lock; called with it held */
+static struct shared_data *
+pin(struct shared_data *d)
+{
+	if (d)
+		++conn_refs;
+	return d;
+}
+
+/* gives back a reference taken by pin() */
+static void
+unpin(struct shared_data *d)
+{
+	pthread_mutex_lock(&conn_lock);
+	if (d == conn) {
+		--conn_refs;
+	} else {
+		for (int i = 0; i < RETIRED_LEN; ++i) {
+			if (retired[i].d != d)
+				continue;
+			if (--retired[i].refs == 0) {
+				munmap(d, sizeof(struct shared_data));
+				retired[i].d = NULL;
 			}
+			break;
 		}
-		if (idx == -1)
-			log_err("Module name \"%s\" not found", module_name);
 	}
+	pthread_mutex_unlock(&conn_lock);
+}
 
-	char buf[MSG_LEN];
+/* maps the live segment, dropping a mapping barbar has since retired;
+ * returns NULL while there is no barbar, sets *fresh on a new mapping.
+ * called with conn_lock held */
+static struct shared_data *
+attach(int *fresh)
+{
+	struct shared_data *d;
+	struct stat sb;
+	uint32_t gen;
+	int fd;
+
+	*fresh = 0;
+#ifdef VCLOCK
+	/* a run on the virtual clock never touches a live barbar */
+	return NULL;
+#endif
+	if (conn && __atomic_load_n(&conn->generation, __ATOMIC_ACQUIRE)
+	            == conn_gen)
+		return conn;
+	if (conn) {
+		unmap_conn();
+		conn = NULL;
+	}
+
+	fd = shm_open(SHM_NAME, O_RDWR, 0600);
+	if (fd == -1)
+		return NULL;
+	/* a segment barbar is still setting up may be empty */
+	if (fstat(fd, &sb) == -1 ||
+	    sb.st_size < (off_t)sizeof(struct shared_data)) {
+		close(fd);
+		return NULL;
+	}
+	d = mmap(NULL, sizeof(struct shared_data), PROT_READ | PROT_WRITE,
+	         MAP_SHARED, fd, 0);
+	close(fd);
+	if (d == MAP_FAILED)
+		return NULL;
+
+	gen = __atomic_load_n(&d->generation, __ATOMIC_ACQUIRE);
+	if (d->magic != SHM_MAGIC || d->layout != sizeof(struct shared_data) ||
+	    gen == 0) {
+		munmap(d, sizeof(struct shared_data));
+		return NULL;
+	}
+
+	conn     = d;
+	conn_gen = gen;
+	*fresh   = 1;
+	/* clicks from before we attached are stale */
+	if (conn_idx >= 0) {
+		mbox_seen = __atomic_load_n(&d->mbox[conn_idx].seq,
+		                            __ATOMIC_ACQUIRE);
+		futex_wake(&mbox_seen);
+	}
+	return conn;
+}
+
+/* copies latest into the slot and wakes the consumer,
+ * returns the new version. called with conn_lock held */
+static unsigned long
+store(struct shared_data *d)
+{
+	unsigned long version;
+	struct slot *s = &d->slots[conn_idx];
+
+	pthread_mutex_lock(&d->mutex);
+	version = ++d->version;
+	slots_write_begin(d);
+	memcpy(s, &latest, sizeof(latest));
+	s->ver     = version;
+	s->updated = time(NULL);
+	slots_write_end(d);
+	/* a paused barbar redraws when it resumes */
+	if (!d->paused)
+		pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+	return version;
+}
+
+/* copies e into the entry with its key, or the first free one; entries
+ * beyond KV_LEN are dropped. called with conn_lock held */
+static void
+kv_store(struct shared_data *d, const struct kv *e)
+{
+	struct kv *dst = NULL;
+
+	pthread_mutex_lock(&d->mutex);
+	for (int i = 0; i < KV_LEN && !dst; ++i)
+		if (!d->kv[i].key[0] || !strcmp(d->kv[i].key, e->key))
+			dst = &d->kv[i];
+	if (dst) {
+		__atomic_store_n(&dst->seq, dst->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		dst->type = e->type;
+		dst->len  = e->len;
+		memcpy(dst->key, e->key, KV_KEY);
+		memcpy(&dst->v, &e->v, sizeof(dst->v));
+		__atomic_store_n(&dst->seq, dst->seq + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&d->mutex);
+}
+
+/* stores every value this module shares, called with conn_lock held */
+static void
+kv_republish(struct shared_data *d)
+{
+	for (int i = 0; i < kv_nown; ++i)
+		kv_store(d, &kv_own[i]);
+}
+
+/* hands a new barbar the slot and the shared values,
+ * called with conn_lock held */
+static void
+republish(struct shared_data *d)
+{
+	store(d);
+	kv_republish(d);
+}
+
+/* waits for barbar to come up or restart, then republishes latest */
+static void *
+watch_consumer(void *arg)
+{
+	struct shared_data *d;
+	uint32_t gen;
+	int fresh;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&conn_lock);
+		d = attach(&fresh);
+		if (d && fresh)
+			republish(d);
+		gen = conn_gen;
+		pin(d);
+		pthread_mutex_unlock(&conn_lock);
+
+		/* barbar exiting or restarting changes the generation;
+		 * while there is none, look for one every second */
+		if (d) {
+			futex_wait(&d->generation, gen, NULL);
+			unpin(d);
+		} else {
+			sleep(1);
+		}
+	}
+	return NULL;
+}
+
+/* starts a detached helper thread that won't take the module's signals */
+static int
+spawn_quiet(void *(*fn)(void *))
+{
+	sigset_t all, old;
+	pthread_t tid;
+	int ok;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	ok = pthread_create(&tid, NULL, fn, NULL) == 0;
+	if (ok)
+		pthread_detach(tid);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return ok;
+}
+
+/* resolves the module's slot and starts the watcher on first use.
+ * called with conn_lock held */
+static void
+setup(const char *module_name)
+{
+	if (conn_idx >= 0)
+		return;
+
+	/* find the index based on module name */
+	for (int i = 0; i < (int)NUM_MODULES; ++i) {
+		if (strcmp(MODULES[i], module_name) == 0) {
+			conn_idx = i;
+			break;
+		}
+	}
+	if (conn_idx == -1)
+		log_err("Module name \"%s\" not found", module_name);
+
+	spawn_quiet(watch_consumer);
+}
+
+/* replaces the module's slot and wakes the consumer; without a barbar
+ * the value is kept and published as soon as one attaches */
+static void
+publish(const char *module_name, const struct slot *s)
+{
+	struct shared_data *d;
+	unsigned long version = 0;
+	int fresh;
+
+	trace_ev(TR_W2S_BEGIN, 0);
+	BENCH_INC(bench_w2s);
+#ifdef VCLOCK
+	/* record the write at virtual time instead of publishing it */
+	fprintf(stderr, "%lld w2s %s %d %lld %s\n", (long long)clk_now(),
+	        module_name, s->type, (long long)s->deadline, s->text);
+	return;
+#endif
+	pthread_mutex_lock(&conn_lock);
+	setup(module_name);
+	memcpy(&latest, s, sizeof(latest));
+	d = attach(&fresh);
+	if (d && fresh)
+		kv_republish(d);
+	if (d)
+		version = store(d);
+	pthread_mutex_unlock(&conn_lock);
+
+	trace_ev(TR_W2S_END, version);
+}
+
+/* formats into a slot's text or alt, text that doesn't fit in MSG_LEN
+ * is cut at the start of a character and ends in "…" */
+static void
+fmt_text(char *buf, const char *fmt, va_list args)
+{
+	static const char ell[] = "…";
+	size_t n;
+
+	if (vsnprintf(buf, MSG_LEN, fmt, args) < MSG_LEN)
+		return;
+	n = MSG_LEN - sizeof(ell);
+	while (n > 0 && ((unsigned char)buf[n] & 0xc0) == 0x80)
+		--n;
+	memcpy(buf + n, ell, sizeof(ell));
+}
+
+/* fmt_text() with the arguments given */
+static void
+set_text(char *buf, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	fmt_text(buf, fmt, args);
+	va_end(args);
+}
+
+/* writes a formatted string to the module's slot */
+void
+w2s(const char *module_name, const char *fmt, ...)
+{
+	struct slot s = { .type = SLOT_TEXT };
+	va_list args;
+
+	va_start(args, fmt);
+	fmt_text(s.text, fmt, args);
+	va_end(args);
+
+	publish(module_name, &s);
+}
+
+/* writes a formatted string and its short form, shown when the bar
+ * runs out of room, to the module's slot at once */
+void
+w2s2(const char *module_name, const char *alt, const char *fmt, ...)
+{
+	struct slot s = { .type = SLOT_TEXT };
 	va_list args;
+
 	va_start(args, fmt);
-	/* this automatically cuts off at MSG_LEN */
-	vsnprintf(buf, sizeof(buf), fmt, args);
+	fmt_text(s.text, fmt, args);
 	va_end(args);
+	set_text(s.alt, "%s", alt);
+
+	publish(module_name, &s);
+}
+
+/* has the consumer show strftime(fmt) of the time left until deadline */
+void
+w2s_countdown(const char *module_name, time_t deadline, const char *fmt)
+{
+	struct slot s = { .type = SLOT_COUNTDOWN, .period = 1,
+	                  .deadline = deadline };
+
+	snprintf(s.text, MSG_LEN, "%s", fmt);
+	publish(module_name, &s);
+}
+
+/* has the consumer show strftime(fmt) of the local time,
+ * re-rendered every period seconds aligned to the epoch */
+void
+w2s_clock(const char *module_name, int period, const char *fmt)
+{
+	struct slot s = { .type = SLOT_CLOCK, .period = period > 0 ? period : 1 };
+
+	snprintf(s.text, MSG_LEN, "%s", fmt);
+	publish(module_name, &s);
+}
+
+/* has the consumer show label followed by a sparkline
+ * of the last samples pushed with w2s_sample() */
+void
+w2s_spark(const char *module_name, int samples, const char *label)
+{
+	struct slot s = { .type = SLOT_SPARK, .samples = samples };
+	int room;
+
+	snprintf(s.text, MSG_LEN, "%s", label);
+	if (samples < 1 || samples > HIST_LEN)
+		s.samples = HIST_LEN;
+	/* no more bars than fit after the label, 3 bytes of utf-8 each */
+	room = (MSG_LEN - 1 - (int)strlen(s.text)) / 3;
+	if (s.samples > room)
+		s.samples = room;
+	publish(module_name, &s);
+}
+
+/* pushes a sample onto the module's history ring, without formatting;
+ * barbar is only woken when the slot shows a sparkline */
+void
+w2s_sample(const char *module_name, double val)
+{
+	struct shared_data *d;
+	struct sample *smp;
+	struct hist *h;
+	uint64_t i;
+	int fresh;
+
+#ifdef VCLOCK
+	fprintf(stderr, "%lld sample %s %g\n", (long long)clk_now(),
+	        module_name, val);
+	return;
+#endif
+	pthread_mutex_lock(&conn_lock);
+	setup(module_name);
+	d = attach(&fresh);
+	if (!d) {
+		pthread_mutex_unlock(&conn_lock);
+		return;
+	}
+	if (fresh)
+		republish(d);
+
+	h   = &d->hist[conn_idx];
+	i   = h->head;
+	smp = &h->s[i % HIST_LEN];
+	smp->ts  = clk_now();
+	smp->val = val;
+	__atomic_store_n(&h->head, i + 1, __ATOMIC_RELEASE);
+
+	if (latest.type == SLOT_SPARK) {
+		pthread_mutex_lock(&d->mutex);
+		slots_write_begin(d);
+		d->slots[conn_idx].ver = ++d->version;
+		slots_write_end(d);
+		if (!d->paused)
+			pthread_cond_broadcast(&d->cond);
+		pthread_mutex_unlock(&d->mutex);
+	}
+	pthread_mutex_unlock(&conn_lock);
+}
+
+/* copies up to max of the newest samples, oldest first, and returns
+ * how many; safe against the writer without taking any lock */
+int
+hist_read(const struct hist *h, struct sample *out, int max)
+{
+	uint64_t head, again, first;
+	int n, drop;
+
+	head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+	n = head < HIST_LEN ? (int)head : HIST_LEN;
+	if (n > max)
+		n = max;
+	for (int k = 0; k < n; ++k)
+		out[k] = h->s[(head - n + k) % HIST_LEN];
+
+	/* the writer may have moved on meanwhile: it may be writing
+	 * sample again, which overwrites sample again - HIST_LEN */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	again = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+	first = again + 1 > HIST_LEN ? again + 1 - HIST_LEN : 0;
+	drop  = head - n < first ? (int)(first - (head - n)) : 0;
+	if (drop >= n)
+		return 0;
+	memmove(out, out + drop, (n - drop) * sizeof(*out));
+	return n - drop;
+}
+
+/* queues a button event for slot i and wakes its producer */
+void
+mbox_post(struct shared_data *shm_data, int i, int button)
+{
+	struct mbox *m = &shm_data->mbox[i];
 
 	pthread_mutex_lock(&shm_data->mutex);
-	++shm_data->version;
-	snprintf(shm_data->slots[idx], MSG_LEN, "%s", buf);
-	pthread_cond_broadcast(&shm_data->cond);
+	m->button[m->seq % MBOX_LEN] = button;
+	__atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELEASE);
 	pthread_mutex_unlock(&shm_data->mutex);
+	futex_wake(&m->seq);
+}
+
+/* returns the module's oldest unread button event, or 0 if there is none;
+ * events the module fell more than MBOX_LEN behind on are lost */
+int
+mbox_take(const char *module_name)
+{
+	struct shared_data *d;
+	struct mbox *m;
+	uint32_t seq;
+	int fresh, button = 0;
+
+	pthread_mutex_lock(&conn_lock);
+	setup(module_name);
+	d = attach(&fresh);
+	if (d) {
+		if (fresh)
+			republish(d);
+		m = &d->mbox[conn_idx];
+		pthread_mutex_lock(&d->mutex);
+		seq = m->seq;
+		if (seq - mbox_seen > MBOX_LEN)
+			mbox_seen = seq - MBOX_LEN;
+		if (mbox_seen != seq)
+			button = m->button[mbox_seen++ % MBOX_LEN];
+		pthread_mutex_unlock(&d->mutex);
+		if (button)
+			futex_wake(&mbox_seen);
+	}
+	pthread_mutex_unlock(&conn_lock);
+	return button;
+}
+
+/* sleeps for timeout (NULL: for good) or until a button event arrives;
+ * returns the button, 0 on timeout, -1 with errno EINTR on a signal */
+int
+mbox_wait(const char *module_name, const struct timespec *timeout)
+{
+	struct shared_data *d;
+	uint32_t seen;
+	int fresh, button, intr;
+
+#ifdef VCLOCK
+	(void)module_name;
+	return timeout ? clk_nanosleep(timeout, NULL) : pause();
+#endif
+	if ((button = mbox_take(module_name)))
+		return button;
+
+	pthread_mutex_lock(&conn_lock);
+	d = attach(&fresh);
+	if (d && fresh)
+		republish(d);
+	seen = mbox_seen;
+	pin(d);
+	pthread_mutex_unlock(&conn_lock);
+
+	/* without barbar there is nobody to click */
+	if (!d)
+		return timeout ? clk_nanosleep(timeout, NULL) : pause();
+
+	intr = futex_wait(&d->mbox[conn_idx].seq, seen, timeout) == -1 &&
+	       errno == EINTR;
+	unpin(d);
+	if (intr) {
+		errno = EINTR;
+		return -1;
+	}
+	return mbox_take(module_name);
+}
+
+/* blocks while barbar is paused, for modules that poll; returns 1 if
+ * it did, so the caller refreshes at once, 0 if there was no pause and
+ * -1 with errno EINTR on a signal */
+int
+wait_visible(const char *module_name)
+{
+	struct shared_data *d;
+	int fresh, intr, waited = 0;
+
+#ifdef VCLOCK
+	(void)module_name;
+	return 0;
+#endif
+	for (;;) {
+		pthread_mutex_lock(&conn_lock);
+		setup(module_name);
+		d = attach(&fresh);
+		if (d && fresh)
+			republish(d);
+		/* barbar exiting clears the word and wakes us */
+		if (!d || !__atomic_load_n(&d->paused, __ATOMIC_ACQUIRE)) {
+			pthread_mutex_unlock(&conn_lock);
+			return waited;
+		}
+		pin(d);
+		pthread_mutex_unlock(&conn_lock);
+
+		waited = 1;
+		intr = futex_wait(&d->paused, 1, NULL) == -1 && errno == EINTR;
+		unpin(d);
+		if (intr)
+			return -1;
+	}
+}
+
+/* eventfd fed by a helper thread: readable whenever events may be
+ * pending, so modules built around poll() can take them too */
+static void *
+feed_mbox(void *arg)
+{
+	struct shared_data *d;
+	uint32_t seen;
+	uint64_t one = 1;
+	int fresh, pending = 0;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&conn_lock);
+		d = attach(&fresh);
+		if (d && fresh)
+			republish(d);
+		seen = mbox_seen;
+		if (d)
+			pending = __atomic_load_n(&d->mbox[conn_idx].seq,
+			                          __ATOMIC_ACQUIRE) != seen;
+		pin(d);
+		pthread_mutex_unlock(&conn_lock);
+
+		if (!d) {
+			sleep(1);
+			continue;
+		}
+		if (!pending)
+			futex_wait(&d->mbox[conn_idx].seq, seen, NULL);
+		unpin(d);
+		if (!pending)
+			continue;
+
+		write(mbox_efd, &one, sizeof(one));
+		/* wait for the module to take them */
+		while (__atomic_load_n(&mbox_seen, __ATOMIC_ACQUIRE) == seen)
+			futex_wait(&mbox_seen, seen, NULL);
+	}
+	return NULL;
+}
+
+int
+mbox_fd(const char *module_name)
+{
+	pthread_mutex_lock(&conn_lock);
+	setup(module_name);
+	if (mbox_efd < 0) {
+		mbox_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (mbox_efd >= 0 && !spawn_quiet(feed_mbox)) {
+			close(mbox_efd);
+			mbox_efd = -1;
+		}
+	}
+	pthread_mutex_unlock(&conn_lock);
+	return mbox_efd;
+}
+
+/* appends a sparkline of the slot's history to buf */
+static size_t
+render_spark(const struct slot *s, const struct hist *h, char *buf,
+             size_t len)
+{
+	static const char *bars[] = { "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█" };
+	struct sample smp[HIST_LEN];
+	double lo, hi;
+	size_t off;
+	int n, b;
+
+	snprintf(buf, len, "%s", s->text);
+	off = strlen(buf);
+	n = hist_read(h, smp, s->samples);
+	if (n == 0)
+		return off;
+
+	lo = hi = smp[0].val;
+	for (int k = 1; k < n; ++k) {
+		if (smp[k].val < lo)
+			lo = smp[k].val;
+		if (smp[k].val > hi)
+			hi = smp[k].val;
+	}
+	for (int k = 0; k < n; ++k) {
+		b = hi > lo ? (int)((smp[k].val - lo) / (hi - lo) * 7 + 0.5) : 0;
+		/* every bar is 3 bytes of utf-8 */
+		if (off + 3 >= len)
+			break;
+		memcpy(buf + off, bars[b], 3);
+		off += 3;
+	}
+	buf[off] = '\0';
+	return off;
+}
+
+/* keeps e as this module's value for its key and stores it; without
+ * a barbar it is stored as soon as one attaches */
+static void
+kv_put(const char *module_name, struct kv *e)
+{
+	struct shared_data *d;
+	int fresh, i;
+
+#ifdef VCLOCK
+	fprintf(stderr, "%lld kv %s %s %d %u\n", (long long)clk_now(),
+	        module_name, e->key, e->type, e->len);
+	return;
+#endif
+	pthread_mutex_lock(&conn_lock);
+	setup(module_name);
+	for (i = 0; i < kv_nown && strcmp(kv_own[i].key, e->key); ++i)
+		;
+	if (i < KV_LEN) {
+		memcpy(&kv_own[i], e, sizeof(*e));
+		if (i == kv_nown)
+			++kv_nown;
+	}
+	d = attach(&fresh);
+	if (d && fresh)
+		republish(d);
+	else if (d)
+		kv_store(d, e);
+	pthread_mutex_unlock(&conn_lock);
+}
+
+/* shares an integer under key */
+void
+kv_put_int(const char *module_name, const char *key, int64_t val)
+{
+	struct kv e = { .type = KV_INT, .len = 1, .v.i = val };
+
+	snprintf(e.key, KV_KEY, "%s", key);
+	kv_put(module_name, &e);
+}
+
+/* shares a string under key, cut at KV_VAL - 1 bytes */
+void
+kv_put_str(const char *module_name, const char *key, const char *s)
+{
+	struct kv e = { .type = KV_STR };
+
+	snprintf(e.key, KV_KEY, "%s", key);
+	snprintf(e.v.s, KV_VAL, "%s", s);
+	e.len = strlen(e.v.s);
+	kv_put(module_name, &e);
+}
+
+/* shares up to KV_VAL / 8 integers under key */
+void
+kv_put_ints(const char *module_name, const char *key,
+            const int64_t *vals, int n)
+{
+	struct kv e = { .type = KV_INTS };
+
+	if (n < 0)
+		n = 0;
+	if (n > (int)(KV_VAL / sizeof(int64_t)))
+		n = KV_VAL / sizeof(int64_t);
+	snprintf(e.key, KV_KEY, "%s", key);
+	memcpy(e.v.ints, vals, n * sizeof(int64_t));
+	e.len = n;
+	kv_put(module_name, &e);
+}
+
+/* copies the value of key consistently, even from a read-only mapping;
+ * returns 0 if no module shares it */
+int
+kv_read(const struct shared_data *shm_data, const char *key, struct kv *out)
+{
+	uint32_t before, after;
+	int tries;
+
+	for (int i = 0; i < KV_LEN; ++i) {
+		const struct kv *e = &shm_data->kv[i];
+
+		for (tries = 0; tries < 1000; ++tries) {
+			before = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+			if (before & 1) {
+				sched_yield();
+				continue;
+			}
+			memcpy(out, e, sizeof(*out));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			after = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+			if (before == after)
+				break;
+		}
+		if (tries == 1000)
+			continue;
+
+		/* entries are taken in order, so a free one ends the search */
+		out->key[KV_KEY - 1] = '\0';
+		if (!out->key[0])
+			return 0;
+		if (!strcmp(out->key, key)) {
+			out->v.s[KV_VAL - 1] = '\0';
+			return out->type != KV_NONE;
+		}
+	}
+	return 0;
+}
+
+/* kv_read() from the live segment, 0 while there is no barbar */
+int
+kv_get(const char *key, struct kv *out)
+{
+	struct shared_data *d;
+	int fresh, found = 0;
+
+#ifdef VCLOCK
+	(void)key;
+	(void)out;
+	return 0;
+#endif
+	pthread_mutex_lock(&conn_lock);
+	d = attach(&fresh);
+	if (d && fresh && conn_idx >= 0)
+		republish(d);
+	if (d)
+		found = kv_read(d, key, out);
+	pthread_mutex_unlock(&conn_lock);
+	return found;
+}
+
+/* writers changing slots, holding the mutex, bracket it with these so
+ * that slots_snapshot() readers never need the lock */
+void
+slots_write_begin(struct shared_data *shm_data)
+{
+	__atomic_store_n(&shm_data->seq, shm_data->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void
+slots_write_end(struct shared_data *shm_data)
+{
+	__atomic_store_n(&shm_data->seq, shm_data->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* copies all slots consistently, even from a read-only mapping;
+ * returns 0 if writers kept getting in the way */
+int
+slots_snapshot(const struct shared_data *shm_data, struct slot *out)
+{
+	uint32_t before, after;
+
+	for (int tries = 0; tries < 1000; ++tries) {
+		before = __atomic_load_n(&shm_data->seq, __ATOMIC_ACQUIRE);
+		if (before & 1) {
+			sched_yield();
+			continue;
+		}
+		memcpy(out, shm_data->slots, sizeof(shm_data->slots));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&shm_data->seq, __ATOMIC_RELAXED);
+		if (before == after)
+			return 1;
+	}
+	return 0;
+}
+
+/* renders the text of a slot as of now into buf */
+static size_t
+render_text(const struct slot *s, const struct hist *h, time_t now,
+            char *buf, size_t len)
+{
+	struct tm tm;
+	time_t left;
+
+	switch (s->type) {
+	case SLOT_COUNTDOWN:
+		left = s->deadline > now ? s->deadline - now : 0;
+		gmtime_r(&left, &tm);
+		break;
+	case SLOT_CLOCK:
+		localtime_r(&now, &tm);
+		break;
+	case SLOT_SPARK:
+		return render_spark(s, h, buf, len);
+	default:
+		snprintf(buf, len, "%s", s->text);
+		return strlen(buf);
+	}
+
+	/* strftime leaves buf undefined when it returns 0 */
+	len = strftime(buf, len, s->text, &tm);
+	buf[len] = '\0';
+	return len;
+}
+
+/* renders a slot as of now into buf, returns the length written;
+ * a slot barbar restored is marked until its producer rewrites it */
+size_t
+render_slot(const struct slot *s, const struct hist *h, time_t now,
+            char *buf, size_t len)
+{
+	size_t off = 0, n, k;
+	unsigned char lead;
+
+	if (!s->stale)
+		return render_text(s, h, now, buf, len);
+
+	snprintf(buf, len, "%s", STALE_MARK);
+	off = strlen(buf);
+	n = off + render_text(s, h, now, buf + off, len - off);
+
+	/* the mark may push the end of a long text out mid-character */
+	if (n == len - 1) {
+		for (k = n; k > off && ((unsigned char)buf[k - 1] & 0xc0) == 0x80; --k)
+			;
+		lead = k > off ? buf[k - 1] : 0;
+		if ((lead >= 0xf0 && n - k < 3) || (lead >= 0xe0 && n - k < 2) ||
+		    (lead >= 0xc0 && n - k < 1))
+			buf[n = k - 1] = '\0';
+	}
+	return n;
+}
+
+/* renders slot s as of now into c for layout(); a short form barbar
+ * restored is marked too, or dropped where the mark doesn't fit */
+void
+render_cell(struct cell *c, const struct slot *s, const struct hist *h,
+            time_t now)
+{
+	render_slot(s, h, now, c->full, MSG_LEN);
+	if (!s->stale)
+		memcpy(c->alt, s->alt, MSG_LEN);
+	else if (!s->alt[0] || strlen(STALE_MARK) + strlen(s->alt) >= MSG_LEN)
+		c->alt[0] = '\0';
+	else
+		snprintf(c->alt, MSG_LEN, "%s%s", STALE_MARK, s->alt);
+	c->ver   = s->ver;
+	c->typed = s->type != SLOT_TEXT;
+}
+
+/* display columns of s, stopping before max is exceeded;
+ * the bytes used are stored in *bytes when it isn't NULL */
+int
+str_cols(const char *s, size_t *bytes, int max)
+{
+	mbstate_t st = {0};
+	size_t len = strlen(s), i = 0, n;
+	int cols = 0, w;
+	wchar_t wc;
+
+	while (i < len) {
+		n = mbrtowc(&wc, s + i, len - i, &st);
+		if (n == (size_t)-1 || n == (size_t)-2) {
+			/* invalid utf-8: one column per byte */
+			memset(&st, 0, sizeof(st));
+			n = 1;
+			w = 1;
+		} else {
+			w = wcwidth(wc);
+			if (w < 0)
+				w = 0;
+		}
+		if (cols + w > max)
+			break;
+		cols += w;
+		i += n;
+	}
+	if (bytes)
+		*bytes = i;
+	return cols;
+}
+
+/* shortens the text of c to at most cols columns, ending in "…" */
+void
+elide(struct cell *c, int cols)
+{
+	static const char ell[] = "…";
+	const char *src = c->show;
+	size_t bytes;
+
+	if (cols <= 0) {
+		c->elided[0] = '\0';
+		c->show = c->elided;
+		c->cols = 0;
+		return;
+	}
+
+	c->cols = str_cols(src, &bytes, cols - 1);
+	if (bytes > MSG_LEN - sizeof(ell)) {
+		/* cut at the start of the character that doesn't fit */
+		bytes = MSG_LEN - sizeof(ell);
+		while (bytes > 0 && ((unsigned char)src[bytes] & 0xc0) == 0x80)
+			--bytes;
+		memmove(c->elided, src, bytes);
+		c->elided[bytes] = '\0';
+		c->cols = str_cols(c->elided, NULL, cols - 1);
+	} else {
+		memmove(c->elided, src, bytes);
+	}
+	memcpy(c->elided + bytes, ell, sizeof(ell));
+	c->show = c->elided;
+	c->cols += 1;
+}
+
+/*
+ * fits the n cells into BAR_COLS columns and writes them to out, in
+ * order, under the budgets of the modules they come from:
+ *  - every module is held to its max budget
+ *  - while the line is too wide, the module furthest above its min
+ *    budget switches to its short form, or else gets elided
+ * returns the number of bytes written
+ */
+size_t
+layout(struct cell *cells, int n, char *out, size_t len)
+{
+	static int sep_cols = -1;
+	const size_t sep_len = strlen(SEP);
+	size_t cur_len = 0;
+	int total = 0, shown = 0;
+
+	if (sep_cols < 0)
+		sep_cols = str_cols(SEP, NULL, MAX_LEN);
+
+	for (int i = 0; i < n; ++i) {
+		struct cell *c = &cells[i];
+
+		/* only re-measure slots that changed */
+		if (c->typed || c->measured != c->ver) {
+			c->full_cols = str_cols(c->full, NULL, MAX_LEN);
+			c->alt_cols  = str_cols(c->alt, NULL, MAX_LEN);
+			c->measured  = c->typed ? 0 : c->ver;
+		}
+		c->show = c->full;
+		c->cols = c->full_cols;
+		if (c->full[0] == '\0')
+			continue;
+
+		int max = BUDGETS[c->mod].max;
+		if (max > 0 && c->cols > max) {
+			if (c->alt[0] != '\0' && c->alt_cols <= max) {
+				c->show = c->alt;
+				c->cols = c->alt_cols;
+			} else {
+				elide(c, max);
+			}
+		}
+		total += c->cols + (shown++ ? sep_cols : 0);
+	}
+
+	while (total > BAR_COLS) {
+		struct cell *c = NULL;
+		int i, best = 0, min = 0;
+
+		for (i = 0; i < n; ++i) {
+			int slack = cells[i].cols - BUDGETS[cells[i].mod].min;
+			if (cells[i].show[0] != '\0' && slack > best) {
+				best = slack;
+				c = &cells[i];
+				min = BUDGETS[cells[i].mod].min;
+			}
+		}
+		if (!c)
+			break;
+
+		int before = c->cols;
+		if (c->show == c->full && c->alt[0] != '\0' &&
+		    c->alt_cols < c->cols && c->alt_cols >= min) {
+			c->show = c->alt;
+			c->cols = c->alt_cols;
+		} else {
+			int want = c->cols - (total - BAR_COLS);
+			elide(c, want > min ? want : min);
+		}
+		if (c->cols >= before)
+			break;
+		total -= before - c->cols;
+	}
+
+	/* join the shown texts, dropping whatever no longer fits in out */
+	for (int i = 0; i < n; ++i) {
+		const char *slot = cells[i].show;
+		size_t slot_len = strlen(slot);
+		if (slot_len == 0)
+			continue;
+
+		size_t need = slot_len + (cur_len ? sep_len : 0);
+		if (cur_len + need >= len)
+			continue;
+
+		/* first write separator to string if not first module */
+		if (cur_len > 0) {
+			/* the separator is defined in config.h */
+			memcpy(out + cur_len, SEP, sep_len);
+			cur_len += sep_len;
+		}
+		/* then write the full string to memory */
+		memcpy(out + cur_len, slot, slot_len);
+		cur_len += slot_len;
+	}
+
+	/* null terminate */
+	out[cur_len] = '\0';
+	return cur_len;
+}
+
+/* next time a typed slot needs re-rendering, or 0 if none does */
+time_t
+next_tick(const struct shared_data *shm_data, time_t now)
+{
+	time_t tick = 0, t;
+
+	for (int i = 0; i < (int)NUM_MODULES; ++i) {
+		const struct slot *s = &shm_data->slots[i];
+
+		/* an expired countdown stays at zero */
+		if ((s->type != SLOT_COUNTDOWN && s->type != SLOT_CLOCK) ||
+		    (s->type == SLOT_COUNTDOWN && s->deadline <= now))
+			continue;
+		t = (now / s->period + 1) * s->period;
+		if (!tick || t < tick)
+			tick = t;
+	}
+	return tick;
 }
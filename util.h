@@ -1,20 +1,122 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <poll.h>
 #include <semaphore.h>
+#include <signal.h>
 #include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "config.h"
 
 /* const int won't be accepted by compiler */
 #define NUM_MODULES (sizeof(MODULES) / sizeof(MODULES[0]))
 
+/* how the consumer turns a slot into text */
+enum slot_type {
+	SLOT_TEXT,      /* text is shown as is */
+	SLOT_COUNTDOWN, /* text is a strftime format for the time left */
+	SLOT_CLOCK,     /* text is a strftime format for the local time */
+	SLOT_SPARK,     /* text is a label for a sparkline of the history */
+};
+
+struct slot {
+	int             type;
+	int             period;   /* seconds between renders of typed slots */
+	time_t          deadline; /* end of a countdown */
+	int             samples;  /* history samples in a sparkline */
+	unsigned long   ver;      /* version of the last change to the slot */
+	time_t          updated;  /* when its producer last wrote it */
+	int             stale;    /* restored by barbar, not yet rewritten */
+	char            text[MSG_LEN];
+	char            alt[MSG_LEN]; /* optional short form of text */
+};
+
+/* samples kept per slot */
+#define HIST_LEN 32
+
+struct sample {
+	int64_t         ts;  /* epoch seconds */
+	double          val;
+};
+
+/* a ring of numeric samples with a single writer, the slot's producer.
+ * it is read without the lock: sample i is valid once head > i, and
+ * until the writer starts on sample i + HIST_LEN, see hist_read() */
+struct hist {
+	uint64_t        head; /* samples ever pushed */
+	struct sample   s[HIST_LEN];
+};
+
+/* events posted for one slot by clicks on the bar */
+#define MBOX_LEN 8
+
+/* any number of posters, under the mutex, and one reader, the slot's
+ * producer; seq counts events ever posted and is the futex it waits on */
+struct mbox {
+	uint32_t        seq;
+	int32_t         button[MBOX_LEN]; /* x11 buttons: 1-3 clicks, 4-5 scroll */
+};
+
+/* values modules share with each other, under keys named "module.name"
+ * by convention; entries are taken in order and never given back */
+#define KV_LEN 16
+#define KV_KEY 32
+#define KV_VAL 256
+
+enum kv_type { KV_NONE, KV_INT, KV_STR, KV_INTS };
+
+/* written under the mutex, read without it: seq is odd while the
+ * entry changes, see kv_read() */
+struct kv {
+	uint32_t        seq;
+	int32_t         type;
+	uint32_t        len;  /* KV_STR: bytes before the '\0', KV_INTS: values */
+	char            key[KV_KEY];
+	union {
+		int64_t i;
+		int64_t ints[KV_VAL / sizeof(int64_t)];
+		char    s[KV_VAL];
+	} v;
+};
+
+#define SHM_MAGIC 0x72616262u /* "bbar" */
+
 /* the struct used by consumer and producers for IPC */
 struct shared_data {
+	uint32_t        magic;      /* SHM_MAGIC once barbar set it up */
+	uint32_t        layout;     /* sizeof(struct shared_data) */
+	uint32_t        generation; /* new on every barbar start, 0 on exit,
+	                             * producers futex-wait on it to re-attach */
 	pthread_mutex_t mutex;
 	pthread_cond_t  cond;
 	unsigned long 	version; /* allows simple check for new data */
-	char            slots[NUM_MODULES][MSG_LEN];
+	uint32_t        seq;     /* odd while a writer changes slots, lets
+	                          * read-only readers snapshot them */
+	uint32_t        paused;  /* 1 while the bar is hidden or the screen
+	                          * locked, polling producers futex-wait on it */
+	struct slot     slots[NUM_MODULES];
+	struct hist     hist[NUM_MODULES];
+	struct mbox     mbox[NUM_MODULES];
+	struct kv       kv[KV_LEN];
+};
+
+/* a slot as laid out by the consumer, widths are in display columns */
+struct cell {
+	int           mod;             /* index into MODULES, for its budgets */
+	char          full[MSG_LEN];
+	char          alt[MSG_LEN];    /* module-provided short form */
+	char          elided[MSG_LEN];
+	const char   *show;            /* full, alt or elided */
+	unsigned long ver;             /* slot version at the last copy */
+	unsigned long measured;        /* slot version the widths belong to */
+	bool          typed;           /* rendered here, so measured each time */
+	int           full_cols;
+	int           alt_cols;
+	int           cols;            /* width of show */
 };
 
 /* there is never any need to change this */
@@ -22,6 +124,104 @@ static const char SHM_NAME[] = "/shm_barbar";
 
 /* forward declarations of shared functions */
 void log_err(const char *fmt, ...);
+long futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout);
+long futex_wake(uint32_t *addr);
 void w2s(const char *module_name, const char *fmt, ...);
+void w2s2(const char *module_name, const char *alt, const char *fmt, ...);
+void w2s_countdown(const char *module_name, time_t deadline, const char *fmt);
+void w2s_clock(const char *module_name, int period, const char *fmt);
+void w2s_spark(const char *module_name, int samples, const char *label);
+void w2s_sample(const char *module_name, double val);
+int hist_read(const struct hist *h, struct sample *out, int max);
+void mbox_post(struct shared_data *shm_data, int i, int button);
+int mbox_take(const char *module_name);
+int mbox_wait(const char *module_name, const struct timespec *timeout);
+int mbox_fd(const char *module_name);
+int wait_visible(const char *module_name);
+void kv_put_int(const char *module_name, const char *key, int64_t val);
+void kv_put_str(const char *module_name, const char *key, const char *s);
+void kv_put_ints(const char *module_name, const char *key,
+                 const int64_t *vals, int n);
+int kv_get(const char *key, struct kv *out);
+int kv_read(const struct shared_data *shm_data, const char *key,
+            struct kv *out);
+void slots_write_begin(struct shared_data *shm_data);
+void slots_write_end(struct shared_data *shm_data);
+int slots_snapshot(const struct shared_data *shm_data, struct slot *out);
+size_t render_slot(const struct slot *s, const struct hist *h, time_t now,
+                   char *buf, size_t len);
+time_t next_tick(const struct shared_data *shm_data, time_t now);
+void render_cell(struct cell *c, const struct slot *s, const struct hist *h,
+                 time_t now);
+int str_cols(const char *s, size_t *bytes, int max);
+void elide(struct cell *c, int cols);
+size_t layout(struct cell *cells, int n, char *out, size_t len);
+
+/* modules read the time and sleep through these, so that builds with
+ * -DVCLOCK can run them on a virtual clock: sleeps and poll timeouts
+ * advance it instantly (or BARBAR_VCLOCK_SPEED times faster than real
+ * time), it starts at BARBAR_VCLOCK_START (epoch seconds) or the real
+ * time, the module gets a SIGINT once it reaches BARBAR_VCLOCK_END,
+ * and every w2s() is recorded on stderr instead of reaching barbar */
+time_t       clk_now(void);
+unsigned int clk_sleep(unsigned int secs);
+int          clk_nanosleep(const struct timespec *req, struct timespec *rem);
+int          clk_ppoll(struct pollfd *fds, nfds_t nfds,
+                       const struct timespec *timeout, const sigset_t *mask);
+
+/* update tracing: when BARBAR_TRACE names a directory, every process
+ * appends timestamped events to its own BARBAR_TRACE/<prog>.<pid>.ring
+ * which bartrace merges into chrome / perfetto trace json */
+enum trace_kind {
+	TR_W2S_BEGIN,     /* arg: unused */
+	TR_W2S_END,       /* arg: version published */
+	TR_WAKE,          /* arg: version seen by the consumer */
+	TR_COMPOSE_BEGIN, /* arg: version being composed */
+	TR_COMPOSE_END,   /* arg: bytes composed */
+	TR_WRITE_BEGIN,   /* arg: bytes to write */
+	TR_WRITE_END,     /* arg: write() result */
+	TR_KINDS
+};
+
+#define TRACE_MAGIC 0x72746262u /* "bbtr" */
+#define TRACE_LEN   4096        /* events kept per process */
+
+struct trace_event {
+	uint64_t ns;   /* CLOCK_MONOTONIC, comparable across processes */
+	uint32_t kind;
+	uint32_t arg;
+};
+
+struct trace_ring {
+	uint32_t           magic;
+	int32_t            pid;
+	char               name[16];
+	uint64_t           head; /* total events ever appended */
+	struct trace_event ev[TRACE_LEN];
+};
+
+void trace_ev(enum trace_kind kind, unsigned long arg);
+
+/* build with -DBENCH to have modules report their costs on stderr
+ * as one "module event key=value ..." line per measurement.
+ * every popen(), system() and fork() of a module is wrapped in
+ * BENCH_SPAWN_BEGIN() / BENCH_SPAWN_END(); bench/spawn.sh runs them
+ * through a simulated period with -DVCLOCK and the stubs of bench/stubs
+ * first on PATH, so the cost of the spawns shows */
+#ifdef BENCH
+#define BENCH_INC(c) __atomic_add_fetch(&(c), 1, __ATOMIC_RELAXED)
+#define BENCH_SPAWN_BEGIN()     bench_spawn_begin()
+#define BENCH_SPAWN_END(m, cmd) bench_spawn_end((m), (cmd))
+extern unsigned long bench_w2s;
+extern unsigned long bench_spawns;
+void bench_report(const char *module, const char *event,
+                  const char *fmt, ...);
+void bench_spawn_begin(void);
+void bench_spawn_end(const char *module, const char *cmd);
+#else
+#define BENCH_INC(c) ((void)0)
+#define BENCH_SPAWN_BEGIN()     ((void)0)
+#define BENCH_SPAWN_END(m, cmd) ((void)0)
+#endif
 
 #endif
@@ -0,0 +1,238 @@
+/*
+ * the file watching loop of ccqwatch, for modules that count lines:
+ * todo lists, logs, spools. the file is mapped and parsed once, then
+ * inotify events on its directory only lead to parsing the bytes
+ * appended since, unless it was truncated, replaced or rewritten
+
+ * a rewrite that keeps the size growing is told from an append by a
+ * checksum of the first WATCH_HEAD parsed bytes; rewrites beyond that
+ * go unnoticed until the next full parse (a click on the slot)
+
+ * a last line without its '\n' is parsed once it gets one
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "watch.h"
+
+#ifdef BENCH
+static unsigned long bench_bytes = 0;
+static unsigned long bench_full  = 0;
+#endif
+
+/* fnv-1a */
+static uint32_t
+checksum(const char *s, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	while (len--) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/* drops what was parsed, the caller then parses from the start */
+static void
+forget(struct watch *w)
+{
+	w->reset(w->arg);
+	w->off  = 0;
+	w->head = 0;
+	w->sum  = 0;
+#ifdef BENCH
+	++bench_full;
+#endif
+}
+
+int
+watch_scan(struct watch *w, int full)
+{
+	const char *addr, *cur, *end, *nl;
+	struct stat sb;
+	int fd, changed;
+
+	/* a missing file counts nothing */
+	fd = open(w->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &sb) < 0) {
+		if (fd >= 0)
+			close(fd);
+		changed = full || w->ino;
+		if (changed)
+			forget(w);
+		w->ino = 0;
+		return changed;
+	}
+
+	if (sb.st_ino != w->ino || sb.st_dev != w->dev || sb.st_size < w->off)
+		full = 1;
+	w->dev = sb.st_dev;
+	w->ino = sb.st_ino;
+
+	if (sb.st_size == 0) {
+		close(fd);
+		changed = full || w->off;
+		if (changed)
+			forget(w);
+		return changed;
+	}
+
+	addr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return 0;
+
+	/* same file and no shorter: an append, unless its head changed */
+	if (!full && checksum(addr, w->head) != w->sum)
+		full = 1;
+	if (full)
+		forget(w);
+
+	changed = full;
+	cur = addr + w->off;
+	end = addr + sb.st_size;
+	while (cur < end && (nl = memchr(cur, '\n', end - cur))) {
+		w->line(cur, nl - cur, w->arg);
+		cur = nl + 1;
+		changed = 1;
+	}
+#ifdef BENCH
+	bench_bytes += (cur - addr) - w->off;
+#endif
+	w->off = cur - addr;
+
+	/* the head only grows until it covers WATCH_HEAD parsed bytes */
+	if (w->head < WATCH_HEAD && (size_t)w->off > w->head) {
+		w->head = (size_t)w->off < WATCH_HEAD ? (size_t)w->off : WATCH_HEAD;
+		w->sum  = checksum(addr, w->head);
+	}
+
+	munmap((void *)addr, sb.st_size);
+	return changed;
+}
+
+/* watches the directory of w->path, which also sees the file being
+ * created, or replaced by a rename as editors do */
+static int
+watch_add(int in_fd, struct watch *w)
+{
+	char dir[PATH_MAX], *slash;
+
+	snprintf(dir, sizeof(dir), "%s", w->path);
+	slash = strrchr(dir, '/');
+	if (!slash) {
+		w->name = w->path;
+		strcpy(dir, ".");
+	} else {
+		w->name = w->path + (slash - dir) + 1;
+		if (slash == dir)
+			slash[1] = '\0';
+		else
+			*slash = '\0';
+	}
+
+	w->wd = inotify_add_watch(in_fd, dir, IN_MODIFY | IN_CLOSE_WRITE |
+	                          IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+	                          IN_MOVED_TO);
+	w->dev  = 0;
+	w->ino  = 0;
+	w->off  = 0;
+	w->head = 0;
+	w->sum  = 0;
+	return w->wd;
+}
+
+int
+watch_run(const char *module, struct watch *w, int n,
+          volatile sig_atomic_t *terminate)
+{
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	struct pollfd pfd[2];
+	sigset_t none;
+	uint64_t clicks;
+	ssize_t len;
+	int in_fd, i, full;
+	char dirty[n];
+
+	in_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (in_fd < 0)
+		return -1;
+	for (i = 0; i < n; ++i) {
+		if (watch_add(in_fd, &w[i]) < 0) {
+			close(in_fd);
+			return -1;
+		}
+		watch_scan(&w[i], 1);
+		w[i].show(module, w[i].arg);
+	}
+#ifdef BENCH
+	bench_report(module, "parse", "bytes=%lu full=%lu",
+	             bench_bytes, bench_full);
+#endif
+
+	/* a failed mbox_fd() (-1) is ignored by poll */
+	pfd[0].fd = in_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = mbox_fd(module);
+	pfd[1].events = POLLIN;
+	sigemptyset(&none);
+
+	while (!*terminate) {
+		if (clk_ppoll(pfd, 2, NULL, &none) < 0) {
+			if (errno == EINTR)
+				continue;
+			close(in_fd);
+			return -1;
+		}
+
+		/* a click asks for a parse from the start */
+		full = 0;
+		if (pfd[1].revents) {
+			read(pfd[1].fd, &clicks, sizeof clicks);
+			while (mbox_take(module))
+				;
+			full = 1;
+		}
+
+		/* only the files named in events are looked at */
+		memset(dirty, full, n);
+		while (pfd[0].revents &&
+		       (len = read(in_fd, buf, sizeof buf)) > 0) {
+			for (char *p = buf; p < buf + len;
+			     p += sizeof(*ev) + ev->len) {
+				ev = (const struct inotify_event *)p;
+				for (i = 0; i < n; ++i)
+					if ((ev->mask & IN_Q_OVERFLOW) ||
+					    (ev->wd == w[i].wd && ev->len &&
+					     !strcmp(ev->name, w[i].name)))
+						dirty[i] = 1;
+			}
+		}
+
+		for (i = 0; i < n; ++i)
+			if (dirty[i] && watch_scan(&w[i], full))
+				w[i].show(module, w[i].arg);
+#ifdef BENCH
+		bench_report(module, "parse", "bytes=%lu full=%lu",
+		             bench_bytes, bench_full);
+#endif
+	}
+
+	close(in_fd);
+	return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* bytes at the start of a file whose checksum tells a rewrite from an append */
+#define WATCH_HEAD 4096
+
+/*
+ * a text file a module counts something in, line by line. the module
+ * fills in the first five fields; the engine parses the whole file
+ * once, then only what gets appended, and starts over (calling reset
+ * first) when the file shrinks, is replaced or its head changes
+ */
+struct watch {
+	const char *path;
+	void      (*reset)(void *arg);  /* forget the counts, a full parse follows */
+	void      (*line)(const char *s, size_t len, void *arg); /* without '\n' */
+	void      (*show)(const char *module, void *arg);        /* after parsing */
+	void       *arg;
+
+	/* engine state */
+	const char *name;    /* basename of path */
+	int         wd;      /* inotify watch on the directory */
+	dev_t       dev;
+	ino_t       ino;
+	off_t       off;     /* bytes parsed: up to the end of the last full line */
+	size_t      head;    /* bytes the checksum covers */
+	uint32_t    sum;
+};
+
+/* shows every file, then re-parses and shows them as they change, or
+ * all of them from the start on a click, until *terminate is set.
+ * the caller blocks its termination signals, which are only taken
+ * while waiting; returns 0 then, or -1 on an error */
+int watch_run(const char *module, struct watch *w, int n,
+              volatile sig_atomic_t *terminate);
+
+/* parses what changed in w since the last call, returns 1 if anything
+ * did; full forces a parse from the start */
+int watch_scan(struct watch *w, int full);
+
+#endif